@@ -22,6 +22,14 @@ static void *bootloader_info = NULL;
                   Local functions
 ***************************************************/
 
+static struct Memory_map *mmap_next_entry(struct Memory_map *entry);
+
+/* The size field of an entry of the memory map doesn't take itself into account */
+static struct Memory_map *mmap_next_entry(struct Memory_map *entry)
+{
+  return (struct Memory_map*)((vaddr_t)entry + entry->size + sizeof(entry->size));
+}
+
 /***************************************************
                   Global functions
 ***************************************************/
@@ -92,3 +100,102 @@ void boot_info_get_module(uint32_t mod_number,
 	}
     }
 }
+
+/**
+ * \fn uint32_t boot_info_get_mmap_entries_count(void)
+ * \brief Return the number of entries of the memory map given by the bootloader.
+ *
+ * If the bootloader only gave the amount of lower and upper memory, the memory
+ * map is made of two entries: [0, mem_lower[ and [1MB, 1MB + mem_upper[.
+ */
+uint32_t boot_info_get_mmap_entries_count(void)
+{
+  uint32_t count = 0;
+  
+  if(bootloader_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+    {
+      struct Multiboot_info *mb_info = bootloader_info;
+
+      if (mb_info->flags & MULTIBOOT_INFO_MEM_MAP)
+	{
+	  vaddr_t mmap_end = __boot_get_virtual_address_of(mb_info->mmap_addr + mb_info->mmap_length);
+	  struct Memory_map *entry = (struct Memory_map*)__boot_get_virtual_address_of(mb_info->mmap_addr);
+
+	  while ((vaddr_t)entry < mmap_end)
+	    {
+	      count++;
+	      entry = mmap_next_entry(entry);
+	    }
+	}
+      else if (mb_info->flags & MULTIBOOT_INFO_MEMORY)
+	{
+	  count = 2;
+	}
+    }
+
+  return count;
+}
+
+/**
+ * \fn bool_t boot_info_get_mmap_entry(uint32_t entry_number, paddr_t *start, paddr_t *end, uint32_t *type)
+ * \brief Retrieve an entry of the memory map given by the bootloader.
+ * \param entry_number Index of the entry.
+ * \param start Where to store the address of the first byte of the range.
+ * \param end Where to store the address of the last byte of the range.
+ * \param type Where to store the type of the range (MULTIBOOT_MEMORY_*).
+ * \return TRUE if the entry exists and is addressable, FALSE otherwise.
+ *
+ * Ranges starting beyond 4GB are ignored, ranges ending beyond are truncated.
+ */
+bool_t boot_info_get_mmap_entry(uint32_t entry_number,
+				paddr_t *start,
+				paddr_t *end,
+				uint32_t *type)
+{
+  *start = (paddr_t)NULL;
+  *end   = (paddr_t)NULL;
+  *type  = MULTIBOOT_MEMORY_RESERVED;
+  
+  if(bootloader_magic != MULTIBOOT_BOOTLOADER_MAGIC
+     || entry_number >= boot_info_get_mmap_entries_count())
+    return FALSE;
+
+  struct Multiboot_info *mb_info = bootloader_info;
+
+  if (mb_info->flags & MULTIBOOT_INFO_MEM_MAP)
+    {
+      struct Memory_map *entry = (struct Memory_map*)__boot_get_virtual_address_of(mb_info->mmap_addr);
+
+      for (uint32_t i = 0; i < entry_number; i++)
+	entry = mmap_next_entry(entry);
+
+      if (entry->base_addr_high != 0
+	  || (entry->length_low == 0 && entry->length_high == 0))
+	return FALSE;
+
+      *start = entry->base_addr_low;
+      *type  = entry->type;
+      
+      if (entry->length_high != 0 || entry->base_addr_low + entry->length_low < entry->base_addr_low)
+	*end = MAX_UINT32;
+      else
+	*end = entry->base_addr_low + entry->length_low - 1;
+    }
+  else
+    {
+      //mem_lower and mem_upper are given in KB
+      if (entry_number == 0)
+	{
+	  *start = 0;
+	  *end   = mb_info->mem_lower * KB - 1;
+	}
+      else
+	{
+	  *start = MB;
+	  *end   = MB + mb_info->mem_upper * KB - 1;
+	}
+      *type = MULTIBOOT_MEMORY_AVAILABLE;
+    }
+
+  return TRUE;
+}
@@ -12,6 +12,8 @@
                Local variables
 ****************************************************/
 
+static uint32_t cache_line_size = 0; //0 until the first call to cpu_cache_line_size()
+
 /***************************************************
                Local functions
 ****************************************************/
@@ -75,6 +77,77 @@ void do_cpuid_request(uint32_t request, struct Cpuid_info *cpuid_info)
 	       :);
 }
 
+/**
+ * \fn bool_t cpu_l2_cache_info(struct Cpu_cache_info *cache_info)
+ * \brief Retrieve the geometry of the L2 cache of the CPU.
+ * \param cache_info Pointer on a structure where to store the geometry.
+ * \return TRUE if the geometry is known, FALSE otherwise.
+ *
+ * The geometry is given by the extended CPUID request 0x80000006, supported
+ * by both Intel and AMD processors.
+ */
+bool_t cpu_l2_cache_info(struct Cpu_cache_info *cache_info)
+{
+  //Number of ways for each associativity code of the request 0x80000006
+  static const uint32_t ways[16] = {0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0};
+  struct Cpuid_info cpuid_info;
+
+  if (checkcpu_has_cpuid() == FALSE)
+    return FALSE;
+
+  do_cpuid_request(0x80000000, &cpuid_info);
+
+  if (cpuid_info.eax < 0x80000006)
+    return FALSE;
+
+  do_cpuid_request(0x80000006, &cpuid_info);
+
+  uint32_t size_kb = cpuid_info.ecx >> 16;
+  uint32_t associativity_code = (cpuid_info.ecx >> 12) & 0xF;
+
+  //No L2 cache, or unknown associativity
+  if (size_kb == 0 || (ways[associativity_code] == 0 && associativity_code != 0xF))
+    return FALSE;
+
+  cache_info->size = size_kb * 1024;
+  cache_info->associativity = ways[associativity_code];
+  cache_info->line_size = cpuid_info.ecx & 0xFF;
+
+  return TRUE;
+}
+
+/**
+ * \fn uint32_t cpu_cache_line_size(void)
+ * \brief Retrieve the size of a line of the data caches of the CPU.
+ * \return The size in bytes, CPU_DEFAULT_CACHE_LINE_SIZE if it is unknown.
+ *
+ * The size is given by the CLFLUSH line size of the CPUID request 1, or by
+ * the L2 cache geometry when CLFLUSH isn't supported.
+ */
+uint32_t cpu_cache_line_size(void)
+{
+  struct Cpuid_info cpuid_info;
+  struct Cpu_cache_info l2_cache;
+
+  if (cache_line_size != 0)
+    return cache_line_size;
+
+  cache_line_size = CPU_DEFAULT_CACHE_LINE_SIZE;
+
+  if (checkcpu_has_cpuid() == FALSE)
+    return cache_line_size;
+
+  do_cpuid_request(1, &cpuid_info);
+
+  //CLFLUSH feature flag, the line size is given in 8-byte units
+  if ((cpuid_info.edx & (1UL << 19)) && ((cpuid_info.ebx >> 8) & 0xFF) != 0)
+    cache_line_size = ((cpuid_info.ebx >> 8) & 0xFF) * 8;
+  else if (cpu_l2_cache_info(&l2_cache) == TRUE && l2_cache.line_size != 0)
+    cache_line_size = l2_cache.line_size;
+
+  return cache_line_size;
+}
+
 void checkcpu(void)
 {
   if (checkcpu_has_cpuid() == TRUE)
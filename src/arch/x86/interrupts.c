@@ -8,6 +8,7 @@
 #include <kernel/kernel.h>
 #include <kernel/kprintf.h>
 #include <kernel/panic.h>
+#include <kernel/mm/virtual_pages.h>
 
 #include <x86/interrupts.h>
 #include <x86/idt.h>
@@ -64,6 +65,12 @@ void interrupt_dispatcher(struct User_context *u_context)
   	{
   	  vaddr_t fault_addr;
   	  asm volatile ("movl %%cr2, %0" : "=a" (fault_addr));
+
+	  //A non-present page of a lazy kernel region, accessed by the kernel, is mapped on demand
+	  if (!(u_context->context.error_code & 1) && !(u_context->context.error_code & 4) &&
+	      vregion_page_fault(fault_addr))
+	    return;
+
   	  kprintf("Fault's address: %p (instruction at %p)\n",fault_addr, u_context->context.eip);
 
   	  if (u_context->context.error_code & 1)
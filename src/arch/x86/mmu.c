@@ -97,7 +97,8 @@ void mmu_init(void)
 {
   mmu_context_cache = objs_cache_create("Mmu_context",
 					sizeof(struct Mmu_context),
-					2);
+					2,
+					0);
   if (mmu_context_cache == NULL)
     {
       panic("Creation of a cache for Mmu_context structures failed in mmu_init()!\n");
@@ -35,6 +35,7 @@ extern uint32_t _first_kpgt[1024];
 
 static void load_pgd(void* pgd);
 static void enable_paging(void);
+static ppn_t pgt_ppage_alloc(void);
 
 /**
 * \fn static void load_pgd(void* pgd)
@@ -66,6 +67,24 @@ static void enable_paging(void)
 
 
 
+/**
+ * \fn static ppn_t pgt_ppage_alloc(void)
+ * \brief Allocate a physical page for a new page table.
+ * \return The number of the allocated physical page.
+ *
+ * While the buddy allocator is not initialised (e.g. when the physical pages'
+ * descriptors are mapped), the page comes from the boot allocator and it is
+ * not zeroed. Otherwise it comes from the pool of zeroed pages.
+ */
+static ppn_t pgt_ppage_alloc(void)
+{
+  if (physical_pages_initialized() == TRUE)
+    return ppage_alloc_zeroed();
+
+  return _boot_physical_pages_alloc(1);
+}
+
+
 /*****************************************************************
                       Public functions
 ****************************************************************/
@@ -295,28 +314,22 @@ void map_page(ppn_t ppn, vpn_t vpn, uint32_t flags)
 
       if ( !(pde & PAGE_PRESENT) )
 	{
-	  panic("(%s()) Page table not present !\n", __func__);
-	  /* /\** \todo If we map a page in the user space, allocate a physical pages */
-	  /*  *        from the user's physical pages list ?*\/ */
-	  /* paddr_t new_pgt_paddr = ppage_to_paddr(ppage_alloc()); */
-
-	  /* if(new_pgt_paddr != (paddr_t)NULL) */
-	  /*   { */
-	  /*     //The new value to load in the page directory entry */
-	  /*     pde = new_pgt_paddr | flags; */
-
-	  /*     //We associate this new page table to the page directory entry */
-	  /*     set_pde(pde_index, pde); */
-
-	  /*     //Clear the allocated page table. */
-	  /*     /\** \todo Optimise with a memset()*\/ */
-	  /*     uint32_t i; */
-	  /*     for(i=0; i<NBR_PT_ENTRIES ;i++) */
-	  /* 	{ */
-	  /* 	  set_pte(pde_index,i,0); */
-	  /* 	} */
-	}
+	  //The page table is allocated on demand (e.g. the kernel space beyond its first 4MB)
+	  paddr_t new_pgt_paddr = ppn_to_paddr(pgt_ppage_alloc());
 
+	  set_pde(pde_index,
+		  new_pgt_paddr |
+		  (flags & PAGE_USER) |
+		  PAGE_READ_WRITE |
+		  PAGE_PRESENT);
+
+	  //We clear the new page table through the recursive paging entry
+	  vaddr_t new_pgt_vaddr = REC_PAGING_ENTRY * 4*MB + pde_index * 4*KB;
+	  invlpg(new_pgt_vaddr);
+
+	  if (physical_pages_initialized() == FALSE)
+	    memset((void*)new_pgt_vaddr, 0, PT_SIZE);
+	}
    
       pte_t pte = paddr | flags;
       set_pte(pde_index, pte_index, pte);
@@ -345,6 +358,42 @@ void map_pages(ppn_t ppn, vpn_t vpn, size_t nbr_pages, uint32_t flags)
     }
 }
 
+/**
+ * \fn void unmap_page(vpn_t vpn)
+ * \brief Remove the translation of a virtual page.
+ * \param vpn The number of the virtual page to unmap.
+ *
+ * The page table is kept even if it becomes empty, and the physical page
+ * which was mapped is not released: this is up to the caller.
+ */
+void unmap_page(vpn_t vpn)
+{
+  vaddr_t vaddr = vpn_to_vaddr(vpn);
+  size_t pde_index = get_pde_index_of(vaddr);
+  size_t pte_index = get_pte_index_of(vaddr);
+  pde_t pde = get_pde(pde_index);
+
+  if ( !(pde & PAGE_PRESENT) )
+    return;
+
+  if (pde & PAGE_4MB)
+    panic("4MB pages not handled !\n");
+
+  set_pte(pde_index, pte_index, 0);
+  invlpg(vaddr);
+}
+
+void unmap_pages(vpn_t vpn, size_t nbr_pages)
+{
+  while (nbr_pages > 0)
+    {
+      unmap_page(vpn);
+
+      vpn++;
+      nbr_pages--;
+    }
+}
+
 /**
 * \fn void paging_boot_init(void)
 * \brief Set up paging and the required structures
@@ -10,6 +10,8 @@
 #ifndef __ASM__
 
 inline uint32_t most_significant_bit_of(uint32_t i);
+static inline uint32_t least_significant_bit_index(uint32_t i);
+static inline uint32_t most_significant_bit_index(uint32_t i);
 
 /**
  * \fn inline uint32_t most_significant_bit_of(uint32_t i)
@@ -45,6 +47,30 @@ inline uint32_t most_significant_bit_of(uint32_t i)
   return bits;
 }
 
+/**
+ * \fn static inline uint32_t least_significant_bit_index(uint32_t i)
+ * \brief Returns the index (between 0 and 31) of the least significant
+ *        bit set in the given integer, with a single bit-scan instruction.
+ * \param i The integer, must not be 0.
+ * \return The index of the least significant bit set.
+ */
+static inline uint32_t least_significant_bit_index(uint32_t i)
+{
+  return (uint32_t)__builtin_ctzl(i);
+}
+
+/**
+ * \fn static inline uint32_t most_significant_bit_index(uint32_t i)
+ * \brief Returns the index (between 0 and 31) of the most significant
+ *        bit set in the given integer, with a single bit-scan instruction.
+ * \param i The integer, must not be 0.
+ * \return The index of the most significant bit set.
+ */
+static inline uint32_t most_significant_bit_index(uint32_t i)
+{
+  return 31 - (uint32_t)__builtin_clzl(i);
+}
+
 #endif //_ASM__
 
 #endif
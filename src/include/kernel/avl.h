@@ -0,0 +1,56 @@
+/**
+ * \file include/kernel/avl.h
+ * \brief Intrusive AVL trees.
+ *
+ * The nodes are embedded in the elements to sort (like the list.h
+ * macros expect "prev" and "next" fields), avl_entry() gives back the
+ * element owning a node. The tree doesn't allocate anything: insertion
+ * and deletion are O(log n) and never fail.
+ */
+#ifndef KERNEL_AVL_H
+#define KERNEL_AVL_H
+
+#include <types.h>
+
+#ifndef __ASM__
+
+typedef struct Avl_node{
+  struct Avl_node *left;
+  struct Avl_node *right;
+  struct Avl_node *parent;
+  int32_t height;          /**< Height of the subtree rooted at this node (1 for a leaf)*/
+}Avl_node;
+
+/** \brief Compares two nodes of a tree, returns <0, 0 or >0 like strcmp()*/
+typedef int32_t (*avl_cmp_t)(const Avl_node *node1, const Avl_node *node2);
+
+/** \brief Compares a search key with a node of a tree, returns <0, 0 or >0 like strcmp()*/
+typedef int32_t (*avl_key_cmp_t)(const void *key, const Avl_node *node);
+
+typedef struct Avl_tree{
+  Avl_node *root;
+  avl_cmp_t cmp;
+}Avl_tree;
+
+/** \brief Returns the element of type "type" which embeds "node" in its field "member"*/
+#define avl_entry(node, type, member)					\
+  ((type*)((char*)(node) - __builtin_offsetof(type, member)))
+
+#define avl_is_empty(tree)			\
+  ((tree)->root == NULL)
+
+void avl_init(Avl_tree *tree, avl_cmp_t cmp);
+void avl_insert(Avl_tree *tree, Avl_node *node);
+void avl_delete(Avl_tree *tree, Avl_node *node);
+
+Avl_node *avl_first(const Avl_tree *tree);
+Avl_node *avl_last(const Avl_tree *tree);
+Avl_node *avl_next(const Avl_node *node);
+Avl_node *avl_prev(const Avl_node *node);
+
+Avl_node *avl_search_ge(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp);
+Avl_node *avl_search_le(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp);
+
+#endif
+
+#endif
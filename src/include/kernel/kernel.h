@@ -9,6 +9,9 @@
 /** \brief The size of the kernel stack, used during the initialisation process*/
 #define KERNEL_STACK_SIZE 0x4000 //16ko
 
+/** \brief The maximum number of CPUs managed by the kernel (sizes the per-CPU data)*/
+#define MAX_CPUS 1
+
 /** \brief The virtual address of the beginning of the kernel space*/
 #define KERNEL_SPACE 0xC0000000
 #define KERNEL_SPACE_SIZE ((1<<32) - KERNEL_SPACE)
@@ -34,9 +37,6 @@
  *   . Objs_cache structure  .
  *   . cache                 .
  *   +-----------------------+ 
- *   . First slab  for       . 
- *   . Slab structures cache .
- *   +-----------------------+ 
  *   . First slab for        .
  *   . Vregion structures    .
  *   . cache                 .
@@ -0,0 +1,36 @@
+#ifndef KERNEL_MM_KERNEL_STACKS_H
+#define KERNEL_MM_KERNEL_STACKS_H
+
+#include <types.h>
+#include <kernel/kernel.h>
+#include <kernel/mm/virtual_pages.h>
+
+//Mapped pages of a kernel stack
+#define KSTACK_PAGES (KERNEL_STACK_SIZE / VPAGE_SIZE)
+
+//Unmapped pages below a kernel stack: an overflow faults instead of corrupting the memory below
+#define KSTACK_GUARD_PAGES 1
+
+//Maximum number of freed stacks kept by each CPU, ready to be reused
+#define KSTACKS_CPU_CACHE_HIGH 4
+
+#ifndef __ASM__
+
+/**
+ * \struct Kstacks_cpu_cache
+ * \brief Stacks freed on a CPU, still mapped: allocating one of them costs
+ *        no virtual region and no mapping.
+ */
+typedef struct Kstacks_cpu_cache{
+  uint32_t count;
+  Vregion *stacks[KSTACKS_CPU_CACHE_HIGH];
+} Kstacks_cpu_cache;
+
+void kstacks_boot_init(void);
+
+vaddr_t kstack_alloc(void);
+void kstack_free(vaddr_t stack_top);
+
+#endif //__ASM__
+
+#endif
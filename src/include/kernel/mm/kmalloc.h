@@ -0,0 +1,20 @@
+#ifndef KERNEL_MM_KMALLOC_H
+#define KERNEL_MM_KMALLOC_H
+
+#include <types.h>
+
+//Biggest allocation served by a size class, bigger ones get their own virtual region
+#define KMALLOC_MAX_CLASS_SIZE 2048
+
+#define KMALLOC_CLASSES_COUNT 14
+
+#ifndef __ASM__
+
+void kmalloc_boot_init(void);
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+
+#endif //__ASM__
+
+#endif
@@ -9,14 +9,45 @@
 #include <types.h>
 #include <kernel/kernel.h>
 
-#define MAX_PPAGE_BLOCK_ORDER 10
+/* The blocks are of order 0 to MAX_PPAGE_BLOCK_ORDER - 1, it can be set at
+ * build time. The default lets a block of the biggest order (4MB, aligned on
+ * its size) be mapped by a single PSE page directory entry.
+ */
+#ifndef MAX_PPAGE_BLOCK_ORDER
+#define MAX_PPAGE_BLOCK_ORDER 11
+#endif
+
+#if MAX_PPAGE_BLOCK_ORDER < 1 || MAX_PPAGE_BLOCK_ORDER > 20
+#error "MAX_PPAGE_BLOCK_ORDER must be between 1 and 20"
+#endif
+
+#define MAX_PHYSICAL_MEMORY_ZONES 16
+#define PPAGEBLOCK_ORDER (MAX_PPAGE_BLOCK_ORDER - 1) /**< Order of the pageblocks, which group the pages by migrate type*/
+
+#define PPAGES_CPU_CACHE_HIGH  64 /**< A CPU cache holding more pages is drained*/
+#define PPAGES_CPU_CACHE_LOW   32 /**< Number of pages kept by a drained CPU cache*/
+#define PPAGES_CPU_CACHE_BATCH 16 /**< Number of pages taken at once from the buddy lists*/
+#define PPAGES_ZEROED_POOL_HIGH  64 /**< Number of zeroed pages kept in advance*/
+#define PPAGES_ZEROED_POOL_BATCH 8  /**< Number of pages zeroed by a refill of the pool*/
+#define PPAGES_MAX_COLOURS       64 /**< Maximum number of page colours handled*/
+#define PPAGES_COLOUR_CACHE_HIGH 4  /**< Maximum number of pages kept for each colour in a CPU cache*/
+#define PPAGE_NEXT_COLOUR MAX_UINT32 /**< Ask for the next colour of the CPU (round-robin)*/
+#define PPAGES_WATERMARK_MIN  0 /**< Only the allocations following a reclaim may go under it*/
+#define PPAGES_WATERMARK_LOW  1 /**< Under it the shrinkers are run*/
+#define PPAGES_WATERMARK_HIGH 2 /**< The shrinkers are run until the zones are above it*/
+#define PPAGES_WATERMARKS     3
+#define PPAGES_WATERMARK_MIN_RATIO 128 /**< The min watermark of a zone is its number of pages divided by this value*/
+#define PPAGES_RECLAIM_RETRIES 3 /**< Number of reclaims before an allocation fails*/
+#define PPAGES_DMA_LIMIT (16 * MB) /**< The memory below is a zone of its own, for the ISA DMA buffers*/
+#define PPAGES_DMA_RESERVE_RATIO 4 /**< Part of the DMA zone kept for the range allocations if there is memory above*/
+#define PPAGES_INIT_CHUNK_SIZE (1UL << (MAX_PPAGE_BLOCK_ORDER + 3)) /**< Number of free pages whose descriptors are initialised at once (multiple of the biggest block)*/
 #define PPAGE_STATUS_USED 1
 #define PPAGE_STATUS_FREE 0
 
 
 #define PPAGE_SHIFT 12
 #define PPAGE_SIZE  (1 << PPAGE_SHIFT)
-#define PPAGE_MASK  (VPAGE_SIZE - 1)
+#define PPAGE_MASK  (PPAGE_SIZE - 1)
 
 #ifndef __ASM__
 
@@ -39,21 +70,52 @@ typedef uint64_t ppn_t;
 #endif
 
 
-typedef struct Physical_page_dscr{
+/*Flags of a physical page descriptor, the lowest bits hold the order of the block*/
+#define PPAGE_ORDER_MASK 0xFFUL
+#define PPAGE_BLOCK_HEAD (1UL << 8)  /**< First page of a block*/
+#define PPAGE_FREE       (1UL << 9)  /**< Head of a block in the buddy free lists*/
+#define PPAGE_RESERVED   (1UL << 10) /**< Page out of the usable RAM*/
+#define PPAGE_SLAB       (1UL << 11) /**< Page used by a slab*/
+#define PPAGE_MIGRATE_SHIFT 12
+#define PPAGE_MIGRATE_MASK  (3UL << PPAGE_MIGRATE_SHIFT) /**< Migrate type of a pageblock, in its first page*/
 
-  bool_t block_head:1;
-  uint32_t block_order:8;
-  uint32_t count; //references counter
+/* Migrate types: the pages are grouped by pageblock according to how their
+ * content may be released, so that long-lived kernel allocations do not
+ * scatter over the whole memory and break every high order block.
+ */
+#define PPAGE_MIGRATE_UNMOVABLE   0 /**< Kernel data which stays in place (page tables, slabs...)*/
+#define PPAGE_MIGRATE_RECLAIMABLE 1 /**< Pages which can be freed on demand (caches)*/
+#define PPAGE_MIGRATE_MOVABLE     2 /**< Pages whose content can be moved (user memory)*/
+#define PPAGE_MIGRATE_TYPES       3
 
-  Slab *slab;
-  
-  vaddr_t mapping;
-  
-  struct Physical_page_dscr *prev, *next;
+/**
+ * \struct Physical_page_dscr
+ * \brief Describe a physical page, packed in 16 bytes on x86.
+ *
+ * The list links are only meaningful for the heads of free blocks (and the
+ * pages of the per-CPU caches) while the other fields are only meaningful
+ * for used pages, hence they share the same memory.
+ */
+typedef struct Physical_page_dscr{
+  uint32_t flags; /**< PPAGE_* flags and order of the block*/
+  uint32_t count; /**< References counter*/
+
+  union{
+    struct{
+      struct Physical_page_dscr *prev, *next;
+    };
+    struct{
+      union{
+	Slab *slab;      /**< Slab which uses the page (PPAGE_SLAB)*/
+	vaddr_t mapping; /**< Virtual address of the page*/
+      };
+      uint32_t private_data; /**< Free for the owner of the page*/
+    };
+  };
 }Ppage;
 
-#define find_buddy(addr, order) \
-  ((addr) & (1UL << (order)))
+#define find_buddy(ppn, order) \
+  ((ppn) ^ (1UL << (order)))
 
 /**
  * \struct Physical_memory_zone
@@ -61,24 +123,57 @@ typedef struct Physical_page_dscr{
  *
  * This structure contains useful information on a physical memory zone and
  * structures used to allocate/free its pages.
+ * A zone matches a range of usable RAM reported by the bootloader, holes and
+ * reserved ranges between zones never reach the buddy lists.
+ * The descriptors of the free pages are initialised by chunks: the pages from
+ * deferred_first_ppn to last_ppn are free but unknown to the buddy lists yet.
+ * The memory below PPAGES_DMA_LIMIT is always a zone of its own: part of it is
+ * kept for the range allocations (DMA buffers) when there is memory above.
+ * A free block is linked to the lists of the migrate type of its pageblock,
+ * which is stored in the descriptor of the first page of the pageblock in the
+ * zone.
  */
-/** \todo Implement used frames lists in Physical_memory_zone ?*/
 typedef struct Physical_memory_zone
 {
-  uint32_t first_ppage_nbr;  /**< Number of the first physical page in the memory zone*/
+  ppn_t first_ppn;           /**< Number of the first physical page in the memory zone*/
+  ppn_t last_ppn;            /**< Number of the last physical page in the memory zone*/
   uint32_t pages_count;      /**< Counter of physical pages in this memory zone*/
   
   uint32_t free_pages_count; /**< Counter of free pages in the memory zone*/
   uint32_t used_pages_count; /**< Counter of used pages in the memory zone*/
+  ppn_t deferred_first_ppn;  /**< First page whose descriptor is not initialised yet, last_ppn + 1 if none*/
+  uint32_t watermarks[PPAGES_WATERMARKS]; /**< Thresholds of free pages: min, low and high*/
+  uint32_t reserved_ppages;  /**< Free pages which only the range allocations may use*/
 
-  uint32_t free_frames_count;
-  uint32_t used_frames_count;
+  uint32_t free_orders_bitmap[PPAGE_MIGRATE_TYPES]; /**< Bit n of [t] is set if free_ppages_blocks_clists[t][n] is not empty*/
+  Ppage *free_ppages_blocks_clists[PPAGE_MIGRATE_TYPES][MAX_PPAGE_BLOCK_ORDER]; /**< Free blocks of each migrate type and order*/
+} Physical_memory_zone;
 
-  //Ppage_descr *ppages;       /**< Pointer to the array of the physical pages's descriptors*/
-  //Ppage_descr *free_frames_lists[MAX_PPAGE_FRAME_ORDER + 1];
 
-} Physical_memory_zone;
+/**
+ * \struct Ppages_cpu_cache
+ * \brief Per-CPU cache of single physical pages in front of the buddy allocator.
+ *
+ * Freed pages are pushed at the head of the list (hot: likely still in the CPU
+ * caches) and pages taken from the buddy lists at its tail (cold). Allocations
+ * use the head, the cache is drained from its tail.
+ * The pages of the cache are accounted as used in their zone.
+ * The pages asked with a cache colour are kept in separate lists, one per
+ * colour.
+ */
+typedef struct Ppages_cpu_cache
+{
+  uint32_t count; /**< Number of pages in the cache*/
+  uint32_t high;  /**< Above this number of pages, the cache is drained*/
+  uint32_t low;   /**< Number of pages kept after a drain*/
+  uint32_t batch; /**< Number of pages taken from the buddy lists when the cache is empty*/
+
+  Ppage *ppages;  /**< Circular list of the pages, from the hottest to the coldest*/
 
+  uint32_t next_colour;                        /**< Colour of the next round-robin allocation*/
+  uint32_t colours_counts[PPAGES_MAX_COLOURS]; /**< Number of pages of each colour*/
+  Ppage *colours_ppages[PPAGES_MAX_COLOURS];   /**< Circular lists of the pages of each colour*/
+} Ppages_cpu_cache;
 
 
 paddr_t  ppage_paddr_of(paddr_t paddr);
@@ -96,11 +191,20 @@ uint32_t ppage_count(const Ppage *ppage);
 void     ppage_ref(Ppage *ppage);
 void     ppage_unref(Ppage *ppage);
 uint32_t ppage_is_free(const Ppage *ppage);
+bool_t   ppage_is_block_head(const Ppage *ppage);
+uint32_t ppage_block_order(const Ppage *ppage);
+Slab    *ppage_slab(const Ppage *ppage);
+
+void physical_memory_zone_add(paddr_t start, paddr_t end);
+Physical_memory_zone *ppn_to_zone(ppn_t ppn);
+bool_t physical_pages_initialized(void);
 
-void physical_page_boot_init(ppn_t first_ppage, ppn_t last_ppage);
+void physical_page_boot_init(void);
 
 ppn_t ppage_block_alloc(uint32_t order);
 Ppage *_ppage_block_alloc(uint32_t order);
+ppn_t ppage_block_alloc_type(uint32_t order, uint32_t migrate_type);
+Ppage *_ppage_block_alloc_type(uint32_t order, uint32_t migrate_type);
 void ppage_block_free(ppn_t ppn, uint32_t order);
 void _ppage_block_free(Ppage *block, uint32_t order);
 
@@ -108,8 +212,32 @@ ppn_t ppage_alloc(void);
 Ppage *_ppage_alloc(void);
 void ppage_free(ppn_t ppn);
 void _ppage_free(Ppage *ppage);
+
+void ppages_cpu_cache_drain(uint32_t cpu);
+
+uint32_t ppages_colours_count(void);
+uint32_t ppage_colour_of(ppn_t ppn);
+ppn_t ppage_alloc_colour(uint32_t colour);
+Ppage *_ppage_alloc_colour(uint32_t colour);
+
+ppn_t ppage_alloc_zeroed(void);
+Ppage *_ppage_alloc_zeroed(void);
+uint32_t ppages_zeroed_pool_refill(void);
+uint32_t ppages_deferred_init(void);
+uint32_t ppages_balance_zones(void);
   
 ppn_t ppages_alloc(size_t nbr_ppages);
+ppn_t ppages_alloc_exact(size_t nbr_ppages);
+Ppage *_ppages_alloc_exact(size_t nbr_ppages);
+void ppages_free_exact(ppn_t ppn, size_t nbr_ppages);
+
+uint32_t ppages_alloc_bulk(ppn_t *ppns, uint32_t nbr_ppages);
+void ppages_free_bulk(ppn_t *ppns, uint32_t nbr_ppages);
+void ppages_release_bulk(ppn_t *ppns, uint32_t nbr_ppages);
+
+ppn_t ppages_alloc_range(size_t nbr_ppages, paddr_t max_paddr, size_t align, size_t boundary);
+Ppage *_ppages_alloc_range(size_t nbr_ppages, paddr_t max_paddr, size_t align, size_t boundary);
+void ppages_free_range(ppn_t ppn, size_t nbr_ppages);
 
 void ppages_set_slab(ppn_t ppn, uint32_t nbr_pages, const Slab *slab);
   
@@ -117,6 +245,10 @@ void ppages_set_slab(ppn_t ppn, uint32_t nbr_pages, const Slab *slab);
 void _boot_physical_pages_init(ppn_t first_free_ppage, ppn_t last_free_ppage);
 ppn_t _boot_physical_pages_alloc(size_t nbr_ppages);
 
+void DEBUG_dump_physical_pages(void);
+bool_t DEBUG_check_physical_pages(void);
+uint32_t DEBUG_unusable_free_space(uint32_t order);
+
 #endif //__ASM__
 
 #endif
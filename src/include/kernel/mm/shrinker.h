@@ -0,0 +1,29 @@
+#ifndef KERNEL_MM_SHRINKER_H
+#define KERNEL_MM_SHRINKER_H
+
+#include <types.h>
+
+#ifndef __ASM__
+
+/**
+ * \struct Shrinker
+ * \brief Callback of a subsystem which can give back physical pages on demand
+ *        (caches of pages, slabs, buffers...).
+ *
+ * The structure belongs to the subsystem, it is only linked to the list of
+ * shrinkers while it is registered.
+ */
+typedef struct Shrinker{
+  const char *name;
+  uint32_t (*shrink)(uint32_t nbr_ppages); /**< Try to free nbr_ppages pages, return the number of pages freed*/
+
+  struct Shrinker *prev, *next;
+} Shrinker;
+
+void shrinker_register(Shrinker *shrinker);
+void shrinker_unregister(Shrinker *shrinker);
+uint32_t shrinkers_run(uint32_t nbr_ppages);
+
+#endif //__ASM__
+
+#endif
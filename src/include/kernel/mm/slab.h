@@ -3,12 +3,10 @@
 
 #include <types.h>
 
+#include <kernel/kernel.h>
 #include <kernel/mm/virtual_pages.h>
 
 #define VPAGES_PER_SLAB_CACHE_OBJS_CACHE 1
-#define VPAGES_PER_SLAB_CACHE_SLAB 1
-
-#define MIN_FREE_OBJS_CACHE_SLAB 2 //must be at least 2
 
 #define CACHE_NAME_MAX_LENGTH 20
 
@@ -16,6 +14,19 @@
 #define SLAB_STATUS_PARTIAL 1
 #define SLAB_STATUS_FULL 2
 
+//Per-CPU magazines
+#define OBJS_MAGAZINE_MIN_ROUNDS 4      //Initial size of the magazines of a cache
+#define OBJS_MAGAZINE_MAX_ROUNDS 61     //An Objs_magazine fills 256 bytes
+#define OBJS_MAGAZINE_RESIZE_MISSES 16  //Depot misses another CPU could have served after which the magazines of a cache grow
+
+//Objs_cache flags
+#define OBJS_CACHE_NO_MAGAZINES 1  //Objects go straight to the slabs (caches used by the allocators themselves)
+#define OBJS_CACHE_HWCACHE_ALIGN 2 //Objects start on a cache line and fill whole lines: two objects never share a line
+#define OBJS_CACHE_ALIGN_SHIFT 8
+#define OBJS_CACHE_ALIGN_MASK (0x1FUL << OBJS_CACHE_ALIGN_SHIFT)
+//Objects start on a multiple of align bytes (a power of 2, at most VPAGE_SIZE)
+#define OBJS_CACHE_ALIGN(align) ((uint32_t)__builtin_ctzl(align) << OBJS_CACHE_ALIGN_SHIFT)
+
 #ifndef __ASM__
 
 
@@ -32,19 +43,56 @@ typedef struct Slab_object{
 } Slab_object;
 
 
+/*The Slab structure of a slab is stored in its last bytes, after the
+  objects: creating a slab needs no other object than its Vregion.
+*/
 typedef struct Slab{
   uint32_t free_objs_count;
   Vregion *vregion;
   Slab_object *free_objs_list;
+  struct Objs_cache *cache; /**< Cache owning the slab*/
 
   struct Slab *prev, *next;
 } Slab;
 
+/* Bytes of a slab of slab_size bytes available for the objects*/
+#define slab_objs_area_size(slab_size) ((slab_size) - sizeof(Slab))
+
+/* The Slab structure of the slab using the given virtual region*/
+#define slab_header_of(vregion)						\
+  ((Slab*)(vpn_to_vaddr(vregion_last_vpn(vregion) + 1) - sizeof(Slab)))
+
+
+/**
+ * \struct Objs_magazine
+ * \brief Stack of free objects of a cache (Bonwick's magazine).
+ */
+typedef struct Objs_magazine{
+  uint32_t rounds; /**< Number of objects in the magazine*/
+  uint32_t size;   /**< Capacity of the magazine, the size of the cache when it was created*/
+  struct Objs_magazine *next;
+  void *objs[OBJS_MAGAZINE_MAX_ROUNDS];
+} Objs_magazine;
+
+/**
+ * \struct Objs_cache_cpu
+ * \brief Magazines of a cache used by a CPU: the allocations and the frees
+ *        of the hot objects only touch this structure.
+ *
+ * Each one is allocated on its own cache lines, away from the depot and from
+ * the structures of the other CPUs.
+ */
+typedef struct Objs_cache_cpu{
+  Objs_magazine *loaded;   /**< Magazine the objects are taken from and given back to*/
+  Objs_magazine *previous; /**< Full or empty magazine, exchanged with loaded before going to the depot*/
+} Objs_cache_cpu;
+
 
 typedef struct Objs_cache{
   char name[CACHE_NAME_MAX_LENGTH + 1];
   size_t obj_size;
-  size_t actual_obj_size;
+  size_t actual_obj_size; /**< Size of an object padded to the alignment*/
+  size_t align;           /**< Alignment of the objects in the slabs*/
 
   void (*constructor)(void *, size_t);
   void (*destructor)(void *, size_t);
@@ -54,6 +102,10 @@ typedef struct Objs_cache{
   uint32_t objs_per_slab;
   size_t wasted_memory_per_slab;
 
+  size_t colour_step;     /**< Difference between the offsets of two colours, the size of a cache line*/
+  uint32_t colours_count; /**< Number of offsets of the first object which fit in the wasted memory*/
+  uint32_t next_colour;   /**< Colour of the next slab created*/
+
   uint32_t free_objs_count;
   uint32_t used_objs_count;
   
@@ -65,6 +117,16 @@ typedef struct Objs_cache{
   Slab *free_slabs;
   Slab *partial_slabs;
   Slab *full_slabs;
+
+  uint32_t flags;
+
+  Objs_cache_cpu *cpus[MAX_CPUS]; /**< Magazines of each CPU, NULL with OBJS_CACHE_NO_MAGAZINES*/
+  uint32_t magazine_size;         /**< Capacity of the new magazines, grown when the depot misses what other CPUs hold*/
+  uint32_t depot_misses;          /**< Depot misses since the last growth of the magazines*/
+  Objs_magazine *depot_full;      /**< Full magazines shared by the CPUs*/
+  Objs_magazine *depot_empty;     /**< Empty magazines shared by the CPUs*/
+  uint32_t depot_full_count;
+  uint32_t depot_empty_count;
   
   struct Objs_cache *prev;
   struct Objs_cache *next;
@@ -75,16 +137,20 @@ void objs_cache_boot_init(void);
 Objs_cache *objs_cache_init(Objs_cache *cache,
 			    const char *name,
 			    size_t obj_size,
-			    uint32_t pages_per_slab);
+			    uint32_t pages_per_slab,
+			    uint32_t flags);
 Objs_cache *objs_cache_create(const char *name,
 			      size_t obj_size,
-			      uint32_t pages_per_slab);
+			      uint32_t pages_per_slab,
+			      uint32_t flags);
 void *objs_cache_alloc(Objs_cache *cache);
 void objs_cache_free(Objs_cache *cache, void *obj);
 
 void *_retrieve_free_obj_from_objs_cache(Objs_cache *cache);
 void _create_slab_for_cache_Vregion(void);
 
+uint32_t objs_cache_drain(Objs_cache *cache);
+
 void DEBUG_dump_objs_cache(Objs_cache *cache);
 
 #endif //__ASM__
@@ -3,12 +3,24 @@
 
 #include <types.h>
 #include <kernel/kernel.h>
+#include <kernel/avl.h>
 
 
 #define VPAGES_PER_SLAB_CACHE_VREGION 1 //must be at least 1
 
 #define MIN_FREE_OBJS_CACHE_VREGION 2
 
+//Number of physical pages given back at once by vregion_free()
+#define VPAGES_FREE_BATCH 32
+
+//Per-CPU caches of single-page regions
+#define VREGIONS_CPU_CACHE_HIGH 32  //Above, the single-page regions freed go back to the global trees
+#define VREGIONS_CPU_CACHE_BATCH 16 //Number of single-page regions reserved at once when a cache is empty
+
+//Vregion flags
+#define VREGION_LAZY 1 //The pages are mapped on their first access, by the page fault handler
+#define VREGION_CACHED 2 //Free single page kept in a CPU cache: still in the used tree, but not allocated
+
 #define VPAGE_SHIFT 12UL
 #define VPAGE_SIZE (1UL << VPAGE_SHIFT)
 #define VPAGE_MASK (VPAGE_SIZE - 1)
@@ -38,10 +50,25 @@ typedef struct Objs_cache Objs_cache;
 typedef struct Virtual_region{
   vpn_t first_vpn;
   size_t nbr_pages;
+  uint32_t flags;
 
-  struct Virtual_region *next;
+  Avl_node addr_node; /**< Links the region in the free or in the used regions' tree, sorted by address*/
+  Avl_node size_node; /**< Links a free region in the best-fit tree, sorted by size then by address*/
 }Vregion;
 
+/**
+ * \struct Vregions_cpu_cache
+ * \brief Per-CPU cache of single-page regions in front of the global trees.
+ *
+ * The regions of the cache stay in the tree of the used regions: they are
+ * reserved, unmapped, and only this CPU hands them out. Allocating or freeing
+ * a single page then touches neither the trees nor cache_Vregion.
+ */
+typedef struct Vregions_cpu_cache{
+  uint32_t count;
+  Vregion *vregions[VREGIONS_CPU_CACHE_HIGH];
+} Vregions_cpu_cache;
+
 vaddr_t vpage_vaddr_of(vaddr_t vaddr);
 vaddr_t vpn_to_vaddr(vpn_t vpn);
 vpn_t vaddr_to_vpn(vaddr_t vaddr);
@@ -55,12 +82,16 @@ void vregion_init(Vregion *region, vpn_t first_vpn, uint32_t nbr_pages);
 
 Vregion *vregion_alloc(uint32_t nbr_pages);
 Vregion *_vregion_alloc(uint32_t nbr_pages);
+Vregion *vregion_alloc_lazy(uint32_t nbr_pages);
+void vregion_free(Vregion *vregion);
+bool_t vregion_page_fault(vaddr_t fault_vaddr);
+Vregion *vaddr_to_vregion(vaddr_t vaddr);
 
 void _boot_virtual_pages_init(vpn_t first_free_vpage, vpn_t last_free_vpage);
 vpn_t _boot_virtual_pages_alloc(uint32_t nbr_vpages);
 
 
-void virtual_page_boot_init(Objs_cache *cache, Vregion *first_used_vregion);
+void virtual_page_boot_init(Objs_cache *cache, Vregion *used_vregions_array, uint32_t nbr_used_vregions);
 
 void DEBUG_dump_free_vregions(void);
 void DEBUG_dump_used_vregions(void);
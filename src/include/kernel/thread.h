@@ -41,6 +41,9 @@ typedef struct Thread{
     its context is saved on the stack, then copied in this structure.*/
   User_context context; 
 
+  /** \brief Top of the kernel stack of the thread, given by kstack_alloc()*/
+  vaddr_t kernel_stack_top;
+
   struct Thread *prev_thread, *next_thread;
 
   struct Thread *prev_scheduled, *next_scheduled;
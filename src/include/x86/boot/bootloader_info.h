@@ -9,6 +9,11 @@ uint32_t boot_info_get_modules_count(void);
 void boot_info_get_module(uint32_t mod_number, 
 			  paddr_t *mod_start,
 			  paddr_t *mod_end);
+uint32_t boot_info_get_mmap_entries_count(void);
+bool_t boot_info_get_mmap_entry(uint32_t entry_number,
+				paddr_t *start,
+				paddr_t *end,
+				uint32_t *type);
 
 #endif
 
@@ -54,6 +54,14 @@
 #define MULTIBOOT_CMDLINE 4
 #define MULTIBOOT_MODS 8
 
+/* Flags of the Multiboot information structure.  */
+#define MULTIBOOT_INFO_MEMORY  1
+#define MULTIBOOT_INFO_MEM_MAP 64
+
+/* Types of the memory map's entries.  */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED  2
+
 
 
 #ifndef __ASM__
@@ -3,6 +3,8 @@
 
 #include <types.h>
 
+//Used when the CPU doesn't report the size of its cache lines
+#define CPU_DEFAULT_CACHE_LINE_SIZE 64
 
 #ifndef __ASM__
 
@@ -13,8 +15,16 @@ struct Cpuid_info{
   uint32_t edx;
 };
 
+struct Cpu_cache_info{
+  uint32_t size;          /**< Size of the cache in bytes*/
+  uint32_t associativity; /**< Number of ways, 0 if the cache is fully associative*/
+  uint32_t line_size;     /**< Size of a cache line in bytes*/
+};
+
 void checkcpu(void);
 void do_cpuid_request(uint32_t request, struct Cpuid_info *cpuid_info);
+bool_t cpu_l2_cache_info(struct Cpu_cache_info *cache_info);
+uint32_t cpu_cache_line_size(void);
 
 #endif
 
@@ -56,6 +56,8 @@ paddr_t virt_to_phys_addr(vaddr_t vaddr);
 
 void map_page(ppn_t ppn, vpn_t vpn, uint32_t flags);
 void map_pages(ppn_t ppn, vpn_t vpn, size_t nbr_pages, uint32_t flags);
+void unmap_page(vpn_t vpn);
+void unmap_pages(vpn_t vpn, size_t nbr_pages);
 
 void set_pde(uint32_t pde_index, pde_t a_pde);
 pde_t get_pde(uint32_t pde_index);
@@ -48,6 +48,29 @@ static inline void cli(void)
 {
   asm volatile("cli");
 }
+
+/**
+ * \fn inline uint64_t rdtsc(void)
+ * \brief Read the time-stamp counter of the CPU.
+ * \return The number of cycles since the reset of the CPU.
+ */
+static inline uint64_t rdtsc(void)
+{
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a" (low), "=d" (high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * \fn inline uint32_t current_cpu_id(void)
+ * \brief Return the index of the running CPU, used to access per-CPU data.
+ *
+ * Only the bootstrap processor runs the kernel for the moment.
+ */
+static inline uint32_t current_cpu_id(void)
+{
+  return 0;
+}
 #endif //__ASM__
 
 
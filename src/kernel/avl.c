@@ -0,0 +1,347 @@
+/**
+ * \file /kernel/avl.c
+ * \brief Intrusive AVL trees: the height of the two subtrees of any node
+ *        differ by at most one, which bounds the depth to 1.44 log2(n).
+ */
+#include <types.h>
+
+#include <kernel/avl.h>
+#include <kernel/panic.h>
+
+
+/*****************************************
+          Private functions
+******************************************/
+
+static inline int32_t _avl_height(const Avl_node *node)
+{
+  return (node == NULL ? 0 : node->height);
+}
+
+static inline void _avl_update_height(Avl_node *node)
+{
+  int32_t left_height  = _avl_height(node->left);
+  int32_t right_height = _avl_height(node->right);
+
+  node->height = 1 + (left_height > right_height ? left_height : right_height);
+}
+
+static inline int32_t _avl_balance(const Avl_node *node)
+{
+  return _avl_height(node->left) - _avl_height(node->right);
+}
+
+/* Replaces old_child by new_child below parent (or at the root if parent is NULL) */
+static inline void _avl_replace_child(Avl_tree *tree, Avl_node *parent, Avl_node *old_child, Avl_node *new_child)
+{
+  if (parent == NULL)
+    tree->root = new_child;
+  else if (parent->left == old_child)
+    parent->left = new_child;
+  else
+    parent->right = new_child;
+
+  if (new_child != NULL)
+    new_child->parent = parent;
+}
+
+/* Returns the new root of the rotated subtree */
+static Avl_node *_avl_rotate_left(Avl_tree *tree, Avl_node *node)
+{
+  Avl_node *pivot = node->right;
+
+  node->right = pivot->left;
+  if (pivot->left != NULL)
+    pivot->left->parent = node;
+
+  _avl_replace_child(tree, node->parent, node, pivot);
+  pivot->left = node;
+  node->parent = pivot;
+
+  _avl_update_height(node);
+  _avl_update_height(pivot);
+
+  return pivot;
+}
+
+/* Returns the new root of the rotated subtree */
+static Avl_node *_avl_rotate_right(Avl_tree *tree, Avl_node *node)
+{
+  Avl_node *pivot = node->left;
+
+  node->left = pivot->right;
+  if (pivot->right != NULL)
+    pivot->right->parent = node;
+
+  _avl_replace_child(tree, node->parent, node, pivot);
+  pivot->right = node;
+  node->parent = pivot;
+
+  _avl_update_height(node);
+  _avl_update_height(pivot);
+
+  return pivot;
+}
+
+/* Restores the heights and the balance from node up to the root */
+static void _avl_rebalance(Avl_tree *tree, Avl_node *node)
+{
+  while (node != NULL)
+    {
+      int32_t balance;
+
+      _avl_update_height(node);
+      balance = _avl_balance(node);
+
+      if (balance > 1)
+	{
+	  if (_avl_balance(node->left) < 0)
+	    _avl_rotate_left(tree, node->left);
+	  node = _avl_rotate_right(tree, node);
+	}
+      else if (balance < -1)
+	{
+	  if (_avl_balance(node->right) > 0)
+	    _avl_rotate_right(tree, node->right);
+	  node = _avl_rotate_left(tree, node);
+	}
+
+      node = node->parent;
+    }
+}
+
+
+/*****************************************
+          Public functions
+******************************************/
+
+/**
+ * \fn void avl_init(Avl_tree *tree, avl_cmp_t cmp)
+ * \brief Initializes an empty tree.
+ * \param tree The tree to initialize.
+ * \param cmp The function ordering the nodes of the tree.
+ */
+void avl_init(Avl_tree *tree, avl_cmp_t cmp)
+{
+  KASSERT(tree != NULL);
+  KASSERT(cmp != NULL);
+
+  tree->root = NULL;
+  tree->cmp  = cmp;
+}
+
+/**
+ * \fn void avl_insert(Avl_tree *tree, Avl_node *node)
+ * \brief Inserts a node in a tree. Nodes comparing equal are kept in insertion order.
+ * \param tree The tree.
+ * \param node The node to insert, it must not be linked in any tree.
+ */
+void avl_insert(Avl_tree *tree, Avl_node *node)
+{
+  Avl_node *parent = NULL;
+  Avl_node **link  = NULL;
+
+  KASSERT(tree != NULL);
+  KASSERT(node != NULL);
+
+  link = &tree->root;
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (tree->cmp(node, parent) < 0)
+	link = &parent->left;
+      else
+	link = &parent->right;
+    }
+
+  node->left   = NULL;
+  node->right  = NULL;
+  node->parent = parent;
+  node->height = 1;
+  *link = node;
+
+  _avl_rebalance(tree, parent);
+}
+
+/**
+ * \fn void avl_delete(Avl_tree *tree, Avl_node *node)
+ * \brief Removes a node from a tree.
+ * \param tree The tree.
+ * \param node The node to remove, it must be linked in tree.
+ */
+void avl_delete(Avl_tree *tree, Avl_node *node)
+{
+  Avl_node *rebalance_from = NULL;
+
+  KASSERT(tree != NULL);
+  KASSERT(node != NULL);
+
+  if (node->left != NULL && node->right != NULL)
+    {
+      //The in-order successor (leftmost node of the right subtree) takes the place of node
+      Avl_node *successor = node->right;
+
+      while (successor->left != NULL)
+	successor = successor->left;
+
+      if (successor->parent != node)
+	{
+	  rebalance_from = successor->parent;
+	  _avl_replace_child(tree, successor->parent, successor, successor->right);
+	  successor->right = node->right;
+	  successor->right->parent = successor;
+	}
+      else
+	{
+	  rebalance_from = successor;
+	}
+
+      successor->left = node->left;
+      successor->left->parent = successor;
+      successor->height = node->height;
+      _avl_replace_child(tree, node->parent, node, successor);
+    }
+  else
+    {
+      rebalance_from = node->parent;
+      _avl_replace_child(tree, node->parent, node, (node->left != NULL ? node->left : node->right));
+    }
+
+  node->left   = NULL;
+  node->right  = NULL;
+  node->parent = NULL;
+
+  _avl_rebalance(tree, rebalance_from);
+}
+
+/**
+ * \fn Avl_node *avl_first(const Avl_tree *tree)
+ * \brief Returns the smallest node of a tree, or NULL if it is empty.
+ */
+Avl_node *avl_first(const Avl_tree *tree)
+{
+  Avl_node *node = tree->root;
+
+  if (node != NULL)
+    while (node->left != NULL)
+      node = node->left;
+
+  return node;
+}
+
+/**
+ * \fn Avl_node *avl_last(const Avl_tree *tree)
+ * \brief Returns the greatest node of a tree, or NULL if it is empty.
+ */
+Avl_node *avl_last(const Avl_tree *tree)
+{
+  Avl_node *node = tree->root;
+
+  if (node != NULL)
+    while (node->right != NULL)
+      node = node->right;
+
+  return node;
+}
+
+/**
+ * \fn Avl_node *avl_next(const Avl_node *node)
+ * \brief Returns the in-order successor of a node, or NULL if it is the greatest one.
+ */
+Avl_node *avl_next(const Avl_node *node)
+{
+  KASSERT(node != NULL);
+
+  if (node->right != NULL)
+    {
+      node = node->right;
+      while (node->left != NULL)
+	node = node->left;
+      return (Avl_node*)node;
+    }
+
+  while (node->parent != NULL && node->parent->right == node)
+    node = node->parent;
+
+  return node->parent;
+}
+
+/**
+ * \fn Avl_node *avl_prev(const Avl_node *node)
+ * \brief Returns the in-order predecessor of a node, or NULL if it is the smallest one.
+ */
+Avl_node *avl_prev(const Avl_node *node)
+{
+  KASSERT(node != NULL);
+
+  if (node->left != NULL)
+    {
+      node = node->left;
+      while (node->right != NULL)
+	node = node->right;
+      return (Avl_node*)node;
+    }
+
+  while (node->parent != NULL && node->parent->left == node)
+    node = node->parent;
+
+  return node->parent;
+}
+
+/**
+ * \fn Avl_node *avl_search_ge(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp)
+ * \brief Looks for the smallest node greater than or equal to a key.
+ * \param tree The tree.
+ * \param key The key to look for.
+ * \param key_cmp Compares key with a node, it must be consistent with the order of the tree.
+ * \return The node found, or NULL if all the nodes are lower than key.
+ */
+Avl_node *avl_search_ge(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp)
+{
+  Avl_node *current = tree->root;
+  Avl_node *found   = NULL;
+
+  while (current != NULL)
+    {
+      if (key_cmp(key, current) <= 0)
+	{
+	  found = current;
+	  current = current->left;
+	}
+      else
+	{
+	  current = current->right;
+	}
+    }
+
+  return found;
+}
+
+/**
+ * \fn Avl_node *avl_search_le(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp)
+ * \brief Looks for the greatest node lower than or equal to a key.
+ * \param tree The tree.
+ * \param key The key to look for.
+ * \param key_cmp Compares key with a node, it must be consistent with the order of the tree.
+ * \return The node found, or NULL if all the nodes are greater than key.
+ */
+Avl_node *avl_search_le(const Avl_tree *tree, const void *key, avl_key_cmp_t key_cmp)
+{
+  Avl_node *current = tree->root;
+  Avl_node *found   = NULL;
+
+  while (current != NULL)
+    {
+      if (key_cmp(key, current) >= 0)
+	{
+	  found = current;
+	  current = current->right;
+	}
+      else
+	{
+	  current = current->left;
+	}
+    }
+
+  return found;
+}
@@ -16,6 +16,8 @@
 #include <kernel/mm/physical_pages.h>
 #include <kernel/mm/virtual_pages.h>
 #include <kernel/mm/slab.h>
+#include <kernel/mm/kernel_stacks.h>
+#include <kernel/mm/kmalloc.h>
 
 #include <x86/boot/bootloader_info.h>
 #include <x86/boot/multiboot.h>
@@ -42,16 +44,30 @@
  */
 void main(uint32_t magic, void* mb_info)
 {
-  /* TODO : retrieve the memory map and the amount of available memory
-   * from mb_info.
-   * NB : for the moment, we assume there is 4MB of memory
-   */
-  
-  ppn_t last_ppage_ppn = paddr_to_ppn(4*MB-1);
+  /*Physical memory detection*/
+  retrieve_bootloader_info(magic, mb_info);
+
+  for (uint32_t i = 0; i < boot_info_get_mmap_entries_count(); i++)
+    {
+      paddr_t start, end;
+      uint32_t type;
+
+      if (boot_info_get_mmap_entry(i, &start, &end, &type) == TRUE
+	  && type == MULTIBOOT_MEMORY_AVAILABLE)
+	{
+	  physical_memory_zone_add(start, end);
+	}
+    }
+
+  ppn_t kernel_end_ppn = paddr_to_ppn(ROUNDUP(kernel_pa_end,PPAGE_SIZE));
+  Physical_memory_zone *boot_zone = ppn_to_zone(kernel_end_ppn);
+
+  if (boot_zone == NULL)
+    panic("No usable memory after the kernel image!\n");
 
   /*Early memory management*/
-  _boot_physical_pages_init(paddr_to_ppn(ROUNDUP(kernel_pa_end,PPAGE_SIZE)), last_ppage_ppn);  
-  _boot_virtual_pages_init(vaddr_to_vpn(KERNEL_SPACE+ROUNDUP(kernel_pa_end,VPAGE_SIZE)), vaddr_to_vpn(KERNEL_SPACE+4*MB-1));
+  _boot_physical_pages_init(kernel_end_ppn, boot_zone->last_ppn);  
+  _boot_virtual_pages_init(vaddr_to_vpn(KERNEL_SPACE+ROUNDUP(kernel_pa_end,VPAGE_SIZE)), vaddr_to_vpn(REC_PAGING_ENTRY*4*MB-1));
 
   /*Architecture initialisation*/      
   gdt_init();
@@ -62,13 +78,15 @@ void main(uint32_t magic, void* mb_info)
   pit_init();
   
   /*Kernel initialisation*/
-  retrieve_bootloader_info(magic, mb_info);
-  physical_page_boot_init(0, last_ppage_ppn);
+  physical_page_boot_init();
   objs_cache_boot_init();
+  kstacks_boot_init();
+  kmalloc_boot_init();
 
   /* Objs_cache *a_cache = objs_cache_create("test", */
   /* 					  sizeof(uint32_t), */
-  /* 					  1); */
+  /* 					  1, */
+  /* 					  0); */
 
   /* KASSERT(a_cache != NULL); */
   /* DEBUG_dump_objs_cache(a_cache); */
@@ -82,7 +100,14 @@ void main(uint32_t magic, void* mb_info)
   irq_enable(0);
 
   //scheduler_launch();
-  asm ("cli\t\n hlt\t\n");
-  for (;;);
+
+  //Idle loop: background work is done between interrupts, then the CPU sleeps
+  for (;;)
+    {
+      if (ppages_balance_zones() == 0 &&
+	  ppages_deferred_init() == 0 &&
+	  ppages_zeroed_pool_refill() == 0)
+	asm volatile ("sti\t\n hlt\t\n");
+    }
 }
 
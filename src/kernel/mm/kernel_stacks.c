@@ -0,0 +1,138 @@
+/**
+ * \file kernel/mm/kernel_stacks.c
+ * \brief Allocation of the kernel stacks of the threads.
+ *
+ * A stack is a virtual region whose lowest page (the guard page) is never
+ * mapped, the other pages are backed when the stack is created. The stacks
+ * freed are kept mapped in a per-CPU cache.
+ */
+#include <types.h>
+
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+
+#include <kernel/mm/kernel_stacks.h>
+#include <kernel/mm/physical_pages.h>
+#include <kernel/mm/virtual_pages.h>
+#include <kernel/mm/shrinker.h>
+
+#include <x86/paging.h>
+#include <x86/x86.h>
+
+static Kstacks_cpu_cache kstacks_cpu_caches[MAX_CPUS];
+
+static uint32_t _kstacks_cpu_caches_shrink(uint32_t nbr_ppages);
+
+static Shrinker kstacks_shrinker = {"Kernel stacks", _kstacks_cpu_caches_shrink, NULL, NULL};
+
+
+static inline vaddr_t kstack_top(const Vregion *stack)
+{
+  return vpn_to_vaddr(vregion_last_vpn(stack) + 1);
+}
+
+/* Reserve the virtual region of a new stack and map all its pages but the guard page */
+static Vregion *_kstack_create(void)
+{
+  Vregion *stack = vregion_alloc(KSTACK_GUARD_PAGES + KSTACK_PAGES);
+
+  if (stack == NULL)
+    return NULL;
+
+  for (vpn_t vpn = vregion_first_vpn(stack) + KSTACK_GUARD_PAGES; vpn <= vregion_last_vpn(stack); vpn++)
+    {
+      Ppage *ppage = _ppage_alloc();
+
+      if (ppage == NULL)
+	{
+	  //The pages already mapped are released with the region
+	  vregion_free(stack);
+	  return NULL;
+	}
+
+      map_page(ppage_to_ppn(ppage),
+	       vpn,
+	       PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+    }
+
+  return stack;
+}
+
+/* Shrinker of the stacks cached by the CPUs */
+static uint32_t _kstacks_cpu_caches_shrink(uint32_t nbr_ppages)
+{
+  uint32_t freed = 0;
+
+  for (uint32_t cpu = 0; cpu < MAX_CPUS && freed < nbr_ppages; cpu++)
+    {
+      Kstacks_cpu_cache *cache = &kstacks_cpu_caches[cpu];
+
+      while (cache->count > 0 && freed < nbr_ppages)
+	{
+	  vregion_free(cache->stacks[--cache->count]);
+	  freed += KSTACK_PAGES;
+	}
+    }
+
+  return freed;
+}
+
+
+/**
+ * \fn void kstacks_boot_init(void)
+ * \brief Initialize the kernel stacks allocator, once the slab allocator is ready.
+ */
+void kstacks_boot_init(void)
+{
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    kstacks_cpu_caches[cpu].count = 0;
+
+  shrinker_register(&kstacks_shrinker);
+}
+
+/**
+ * \fn vaddr_t kstack_alloc(void)
+ * \brief Allocate a kernel stack of KERNEL_STACK_SIZE bytes, with a guard page below.
+ * \return The top of the stack (the initial value of the stack pointer),
+ *         NULL if the memory is exhausted.
+ */
+vaddr_t kstack_alloc(void)
+{
+  Kstacks_cpu_cache *cache = &kstacks_cpu_caches[current_cpu_id()];
+  Vregion *stack = NULL;
+
+  if (cache->count > 0)
+    stack = cache->stacks[--cache->count];
+  else
+    stack = _kstack_create();
+
+  if (stack == NULL)
+    {
+#ifdef DEBUG
+      kprintf("Failed to allocate a kernel stack in %s\n", __func__);
+#endif
+      return (vaddr_t)NULL;
+    }
+
+  return kstack_top(stack);
+}
+
+/**
+ * \fn void kstack_free(vaddr_t stack_top)
+ * \brief Free a kernel stack.
+ * \param stack_top The top of the stack, given by kstack_alloc().
+ */
+void kstack_free(vaddr_t stack_top)
+{
+  Kstacks_cpu_cache *cache = &kstacks_cpu_caches[current_cpu_id()];
+  Vregion *stack = vaddr_to_vregion(stack_top - 1);
+
+  KASSERT(stack != NULL);
+  KASSERT(kstack_top(stack) == stack_top);
+  KASSERT(stack->nbr_pages == KSTACK_GUARD_PAGES + KSTACK_PAGES);
+
+  if (cache->count < KSTACKS_CPU_CACHE_HIGH)
+    cache->stacks[cache->count++] = stack;
+  else
+    vregion_free(stack);
+}
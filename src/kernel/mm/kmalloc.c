@@ -0,0 +1,174 @@
+/**
+ * \file kernel/mm/kmalloc.c
+ * \brief General purpose allocation of kernel memory.
+ *
+ * The small allocations are rounded up to a size class, each class is an
+ * objects cache. The classes are powers of two with a class half-way between
+ * two of them, so that at most a third of an object is wasted (beyond the
+ * first classes). The bigger allocations get their own virtual region.
+ *
+ * No header is stored with the memory: kfree() finds the cache of an object
+ * through the descriptor of the physical page which backs it.
+ */
+#include <types.h>
+#include <math.h>
+
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+
+#include <kernel/mm/kmalloc.h>
+#include <kernel/mm/slab.h>
+#include <kernel/mm/virtual_pages.h>
+#include <kernel/mm/physical_pages.h>
+
+#include <x86/paging.h>
+
+static const struct
+{
+  const char *name;
+  size_t size;
+  uint32_t pages_per_slab;
+} kmalloc_classes[KMALLOC_CLASSES_COUNT] =
+  {
+    {"kmalloc-8", 8, 1},
+    {"kmalloc-16", 16, 1},
+    {"kmalloc-32", 32, 1},
+    {"kmalloc-64", 64, 1},
+    {"kmalloc-96", 96, 1},
+    {"kmalloc-128", 128, 1},
+    {"kmalloc-192", 192, 1},
+    {"kmalloc-256", 256, 1},
+    {"kmalloc-384", 384, 1},
+    {"kmalloc-512", 512, 2},
+    {"kmalloc-768", 768, 2},
+    {"kmalloc-1024", 1024, 4},
+    {"kmalloc-1536", 1536, 4},
+    {"kmalloc-2048", 2048, 4}
+  };
+
+static Objs_cache *kmalloc_caches[KMALLOC_CLASSES_COUNT];
+
+
+/* Index of the smallest size class which can hold size bytes */
+static uint32_t _kmalloc_class_of(size_t size)
+{
+  uint32_t i = 0;
+
+  KASSERT(size <= KMALLOC_MAX_CLASS_SIZE);
+
+  while (kmalloc_classes[i].size < size)
+    i++;
+
+  return i;
+}
+
+/* Allocation too big for a size class: the pages are mapped in a region of their own */
+static void *_kmalloc_large(size_t size)
+{
+  Vregion *vregion = vregion_alloc(ROUNDUP(size, VPAGE_SIZE) / VPAGE_SIZE);
+
+  if (vregion == NULL)
+    return NULL;
+
+  for (vpn_t vpn = vregion_first_vpn(vregion); vpn <= vregion_last_vpn(vregion); vpn++)
+    {
+      Ppage *ppage = _ppage_alloc();
+
+      if (ppage == NULL)
+	{
+	  //The pages already mapped are released with the region
+	  vregion_free(vregion);
+	  return NULL;
+	}
+
+      map_page(ppage_to_ppn(ppage),
+	       vpn,
+	       PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+    }
+
+  vaddr_t vaddr = vpn_to_vaddr(vregion_first_vpn(vregion));
+
+  return (void*)vaddr;
+}
+
+
+/**
+ * \fn void kmalloc_boot_init(void)
+ * \brief Create the caches of the size classes, once the slab allocator is ready.
+ */
+void kmalloc_boot_init(void)
+{
+  for (uint32_t i = 0; i < KMALLOC_CLASSES_COUNT; i++)
+    {
+      kmalloc_caches[i] = objs_cache_create(kmalloc_classes[i].name,
+					    kmalloc_classes[i].size,
+					    kmalloc_classes[i].pages_per_slab,
+					    0);
+
+      if (kmalloc_caches[i] == NULL)
+	panic("Failed to create the cache %s in %s()\n", kmalloc_classes[i].name, __func__);
+    }
+}
+
+/**
+ * \fn void *kmalloc(size_t size)
+ * \brief Allocate kernel memory.
+ * \param size The number of bytes to allocate.
+ * \return Pointer to the allocated memory, NULL if size is 0 or if the memory
+ *         is exhausted.
+ */
+void *kmalloc(size_t size)
+{
+  void *allocated = NULL;
+
+  if (size == 0)
+    return NULL;
+
+  if (size <= KMALLOC_MAX_CLASS_SIZE)
+    allocated = objs_cache_alloc(kmalloc_caches[_kmalloc_class_of(size)]);
+  else
+    allocated = _kmalloc_large(size);
+
+#ifdef DEBUG
+  if (allocated == NULL)
+    kprintf("Failed to allocate %u bytes in %s\n", size, __func__);
+#endif
+
+  return allocated;
+}
+
+/**
+ * \fn void kfree(void *ptr)
+ * \brief Free memory allocated by kmalloc().
+ * \param ptr The pointer given by kmalloc(), nothing is done if it is NULL.
+ */
+void kfree(void *ptr)
+{
+  paddr_t paddr;
+  Slab *slab;
+
+  if (ptr == NULL)
+    return;
+
+  paddr = virt_to_phys_addr((vaddr_t)ptr);
+
+  if (paddr == (paddr_t)NULL)
+    panic("Try to free %p which isn't mapped in %s()\n", ptr, __func__);
+
+  //A small allocation lives in a slab, which knows its cache
+  slab = ppage_slab(paddr_to_ppage(paddr));
+
+  if (slab != NULL)
+    {
+      objs_cache_free(slab->cache, ptr);
+    }
+  else
+    {
+      Vregion *vregion = vaddr_to_vregion((vaddr_t)ptr);
+
+      if (vregion == NULL || vpn_to_vaddr(vregion_first_vpn(vregion)) != (vaddr_t)ptr)
+	panic("Try to free %p which wasn't allocated by kmalloc() in %s()\n", ptr, __func__);
+
+      vregion_free(vregion);
+    }
+}
@@ -1,19 +1,26 @@
 #include <types.h>
 #include <math.h>
+#include <bits.h>
+#include <string.h>
 
 #include <kernel/symbols.h>
 #include <kernel/kprintf.h>
 #include <kernel/list.h>
 #include <kernel/panic.h>
 
+#include <kernel/mm/shrinker.h>
 #include <kernel/mm/slab.h>
 #include <kernel/mm/virtual_pages.h>
 #include <kernel/mm/physical_pages.h>
 
 #include <x86/paging.h>
+#include <x86/x86.h>
+#include <x86/cpucheck.h>
 
 static inline void _ppage_set_free(Ppage *ppage);
 static inline void _ppage_set_used(Ppage *ppage);
+static inline void _ppage_set_block_head(Ppage *ppage, uint32_t order);
+static inline void _ppage_clear_block_head(Ppage *ppage);
 static inline int32_t is_buddy_block(ppn_t ppn_block, uint32_t order);
 static inline void _ppage_set_mapping(Ppage *ppage, vaddr_t vaddr);
 static inline void _ppage_set_slab(Ppage *ppage, Slab *slab);
@@ -21,13 +28,39 @@ static inline void _ppage_set_slab(Ppage *ppage, Slab *slab);
 static ppn_t  _boot_first_free_ppn;
 static ppn_t  _boot_last_free_ppn;
 
-/*TODO : replace the following variables by memory zones*/
 static Ppage *ppages_dscrs;
 static ppn_t first_ppn;
 static ppn_t last_ppn;
 
-static Ppage *free_ppages_blocks_clists[MAX_PPAGE_BLOCK_ORDER] = { NULL };
-static Ppage *used_ppages_blocks_clists[MAX_PPAGE_BLOCK_ORDER] = { NULL };
+//Usable physical memory zones, sorted by increasing addresses
+static Physical_memory_zone memory_zones[MAX_PHYSICAL_MEMORY_ZONES];
+static uint32_t memory_zones_count = 0;
+
+static bool_t ppages_initialized = FALSE;
+
+static Ppages_cpu_cache ppages_cpu_caches[MAX_CPUS];
+
+static uint32_t ppages_colours = 1;       //Number of page colours of the L2 cache, a power of 2
+static uint32_t ppages_colours_order = 0; //log2(ppages_colours)
+
+static Ppage *zeroed_ppages = NULL;    //Circular list of pages already filled with zeros
+static uint32_t zeroed_ppages_count = 0;
+static vpn_t zeroing_window_vpn;       //Virtual page used to access the page to zero
+
+static bool_t ppages_reclaiming = FALSE;
+
+#ifdef DEBUG
+static uint64_t deferred_init_cycles = 0; //Time spent initialising the deferred descriptors
+static uint32_t deferred_init_chunks = 0;
+#endif
+
+//Migrate types whose pageblocks are used, in this order, when a type has no free block left
+static const uint32_t migrate_fallbacks[PPAGE_MIGRATE_TYPES][PPAGE_MIGRATE_TYPES - 1] =
+  {
+    [PPAGE_MIGRATE_UNMOVABLE]   = {PPAGE_MIGRATE_RECLAIMABLE, PPAGE_MIGRATE_MOVABLE},
+    [PPAGE_MIGRATE_RECLAIMABLE] = {PPAGE_MIGRATE_UNMOVABLE, PPAGE_MIGRATE_MOVABLE},
+    [PPAGE_MIGRATE_MOVABLE]     = {PPAGE_MIGRATE_RECLAIMABLE, PPAGE_MIGRATE_UNMOVABLE}
+  };
 
 
 
@@ -40,11 +73,25 @@ static inline int32_t is_buddy_block(ppn_t ppn_block, uint32_t order)
 static inline void _ppage_set_free(Ppage *ppage)
 {
   ppage->count = 0;
+  ppage->flags |= PPAGE_FREE;
 }
 
 static inline void _ppage_set_used(Ppage *ppage)
 {
   ppage->count = 1;
+  ppage->flags &= ~(PPAGE_FREE | PPAGE_SLAB);
+  ppage->slab = NULL;
+  ppage->private_data = 0;
+}
+
+static inline void _ppage_set_block_head(Ppage *ppage, uint32_t order)
+{
+  ppage->flags = (ppage->flags & ~PPAGE_ORDER_MASK) | PPAGE_BLOCK_HEAD | order;
+}
+
+static inline void _ppage_clear_block_head(Ppage *ppage)
+{
+  ppage->flags &= ~PPAGE_BLOCK_HEAD;
 }
 
 inline paddr_t ppage_paddr_of(paddr_t paddr)
@@ -98,15 +145,34 @@ inline void ppage_unref(Ppage *ppage)
   if (ppage->count > 1)
     ppage->count--;
   else if (ppage->count == 1)
-    _ppage_block_free(ppage, ppage->block_order);
+    _ppage_block_free(ppage, ppage_block_order(ppage));
   else
     panic("Try to unreference a free physical page in %s\n", __func__);
 }
 
+/*Return TRUE if the page is the head of a block in the buddy free lists*/
 inline uint32_t ppage_is_free(const Ppage *ppage)
 {
   KASSERT(ppage != NULL);
-  return (ppage_count(ppage) == 0);
+  return ((ppage->flags & PPAGE_FREE) ? TRUE : FALSE);
+}
+
+inline bool_t ppage_is_block_head(const Ppage *ppage)
+{
+  KASSERT(ppage != NULL);
+  return ((ppage->flags & PPAGE_BLOCK_HEAD) ? TRUE : FALSE);
+}
+
+inline uint32_t ppage_block_order(const Ppage *ppage)
+{
+  KASSERT(ppage != NULL);
+  return (ppage->flags & PPAGE_ORDER_MASK);
+}
+
+inline Slab *ppage_slab(const Ppage *ppage)
+{
+  KASSERT(ppage != NULL);
+  return ((ppage->flags & PPAGE_SLAB) ? ppage->slab : NULL);
 }
 
 inline paddr_t ppage_to_paddr(const Ppage *ppage)
@@ -132,17 +198,86 @@ static inline void _ppage_set_slab(Ppage *ppage, Slab *slab)
   KASSERT(slab != NULL);
   
   ppage->slab = slab;
+  ppage->flags |= PPAGE_SLAB;
 }
 
 /***************************************
           Private functions
 ****************************************/
 
+/* Return the descriptor holding the migrate type of the pageblock of a page:
+ * the first page of the pageblock which belongs to the zone.
+ */
+static inline Ppage *_zone_pageblock_head(const Physical_memory_zone *zone, ppn_t ppn)
+{
+  ppn_t head_ppn = ppn & ~((1UL << PPAGEBLOCK_ORDER) - 1);
+
+  if (head_ppn < zone->first_ppn)
+    head_ppn = zone->first_ppn;
+
+  return ppn_to_ppage(head_ppn);
+}
+
+static inline uint32_t _zone_pageblock_type(const Physical_memory_zone *zone, ppn_t ppn)
+{
+  return (_zone_pageblock_head(zone, ppn)->flags & PPAGE_MIGRATE_MASK) >> PPAGE_MIGRATE_SHIFT;
+}
+
+static inline void _ppage_set_migrate_type(Ppage *ppage, uint32_t migrate_type)
+{
+  ppage->flags = (ppage->flags & ~PPAGE_MIGRATE_MASK) | (migrate_type << PPAGE_MIGRATE_SHIFT);
+}
+
+/* Return the orders which have at least a free block, whatever its type.*/
+static inline uint32_t _zone_free_orders(const Physical_memory_zone *zone)
+{
+  uint32_t free_orders = 0;
+
+  for (uint32_t type = 0; type < PPAGE_MIGRATE_TYPES; type++)
+    free_orders |= zone->free_orders_bitmap[type];
+
+  return free_orders;
+}
+
+/* The free lists of a zone are only modified through the following functions
+ * which keep the bitmaps of the non-empty orders up to date.
+ * A block is linked to the lists of the migrate type of its pageblock.
+ */
+static inline void _zone_free_list_push(Physical_memory_zone *zone, Ppage *block, uint32_t order)
+{
+  uint32_t type = _zone_pageblock_type(zone, ppage_to_ppn(block));
+
+  clist_push_tail(zone->free_ppages_blocks_clists[type][order], block);
+  zone->free_orders_bitmap[type] |= (1UL << order);
+}
+
+static inline void _zone_free_list_delete(Physical_memory_zone *zone, Ppage *block, uint32_t order)
+{
+  uint32_t type = _zone_pageblock_type(zone, ppage_to_ppn(block));
 
-static void _range_ppages_set_status(ppn_t first_ppage, ppn_t last_ppage, uint32_t status)
+  clist_delete_el(zone->free_ppages_blocks_clists[type][order], block);
+
+  if (clist_is_empty(zone->free_ppages_blocks_clists[type][order]))
+    zone->free_orders_bitmap[type] &= ~(1UL << order);
+}
+
+
+/* Initialize the descriptors of the pages in [first_ppage, last_ppage] as
+ * blocks of the given status.
+ * If zone is NULL the pages are reserved (holes, BIOS areas...): they are
+ * marked as used but are never linked to any list.
+ * A new pageblock gets the unmovable type if its pages are used (kernel image,
+ * boot allocations), the movable type otherwise.
+ */
+static void _range_ppages_set_status(Physical_memory_zone *zone,
+				     ppn_t first_ppage,
+				     ppn_t last_ppage,
+				     uint32_t status)
 {
   if (status != PPAGE_STATUS_FREE && status != PPAGE_STATUS_USED)
     panic("Incorrect status parameter in %s\n", __func__);
+
+  KASSERT(zone != NULL || status == PPAGE_STATUS_USED);
   
   if (first_ppage > last_ppage)
     {
@@ -161,36 +296,31 @@ static void _range_ppages_set_status(ppn_t first_ppage, ppn_t last_ppage, uint32
 	      ppn + (1UL << order) - 1 <= last_ppage)
 	    {
 	      //we initialize the descriptor of the page which is the head of the block
+	      ppages_dscrs[ppn].flags = (zone == NULL) ? PPAGE_RESERVED : 0;
+	      _ppage_set_block_head(&ppages_dscrs[ppn], order);
+
+	      if (zone != NULL && _zone_pageblock_head(zone, ppn) == &ppages_dscrs[ppn])
+		_ppage_set_migrate_type(&ppages_dscrs[ppn],
+					(status == PPAGE_STATUS_USED) ? PPAGE_MIGRATE_UNMOVABLE : PPAGE_MIGRATE_MOVABLE);
 
 	      if (status == PPAGE_STATUS_FREE)
-		_ppage_set_free(&ppages_dscrs[ppn]);
-	      else //if (status == PPAGE_STATUS_USED)
-		_ppage_set_used(&ppages_dscrs[ppn]);
- 
-	      ppages_dscrs[ppn].block_head = TRUE;
-	      ppages_dscrs[ppn].block_order = order;
-	      
-	      ppages_dscrs[ppn].slab = NULL;
-	      ppages_dscrs[ppn].mapping = (vaddr_t)NULL;
-		  
-	      if (status == PPAGE_STATUS_FREE)
-		clist_push_tail(free_ppages_blocks_clists[order], &ppages_dscrs[ppn]);
+		{
+		  _ppage_set_free(&ppages_dscrs[ppn]);
+		  _zone_free_list_push(zone, &ppages_dscrs[ppn], order);
+		  zone->free_pages_count += (1UL << order);
+		}
 	      else //if (status == PPAGE_STATUS_USED)
-		clist_push_tail(used_ppages_blocks_clists[order], &ppages_dscrs[ppn]);
+		{
+		  _ppage_set_used(&ppages_dscrs[ppn]);
+		  if (zone != NULL)
+		    zone->used_pages_count += (1UL << order);
+		}
 
 	      //we initialize the descriptors of the pages in the block
 	      for (ppn_t i = ppn + 1 ; i < ppn + (1UL << order) ; i++)
 		{
-		  if (status == PPAGE_STATUS_FREE)
-		    _ppage_set_free(&ppages_dscrs[i]);
-		  else //if (status == PPAGE_STATUS_USED)
-		    _ppage_set_used(&ppages_dscrs[i]);
-		  
-		  ppages_dscrs[i].block_head = FALSE;
-		  ppages_dscrs[i].block_order = order; //in fact the value of this field is meaningless in this case since block_head = FALSE
-		  ppages_dscrs[i].slab = NULL;
-		  ppages_dscrs[i].mapping = (vaddr_t)NULL;
-		  
+		  ppages_dscrs[i].flags = (zone == NULL) ? PPAGE_RESERVED : 0;
+		  ppages_dscrs[i].count = (status == PPAGE_STATUS_FREE) ? 0 : 1;
 		  ppages_dscrs[i].prev = NULL;
 		  ppages_dscrs[i].next = NULL;
 		}
@@ -203,168 +333,210 @@ static void _range_ppages_set_status(ppn_t first_ppage, ppn_t last_ppage, uint32
     }
 }
 
+/* Initialize the descriptors of the next chunk of deferred pages of a zone
+ * and give these pages to its buddy lists.
+ * A chunk ends on a boundary of PPAGES_INIT_CHUNK_SIZE pages, which is a
+ * multiple of the biggest block: a block is never merged with a buddy whose
+ * descriptor is not initialised.
+ * Return the number of pages initialised, 0 if the whole zone is initialised.
+ */
+static uint32_t _zone_deferred_init_chunk(Physical_memory_zone *zone)
+{
+  ppn_t first_ppage = zone->deferred_first_ppn;
+  ppn_t last_ppage = first_ppage | (PPAGES_INIT_CHUNK_SIZE - 1);
 
-/**************************************************
-               Public functions
-**************************************************/
+  if (first_ppage > zone->last_ppn)
+    return 0;
 
+  if (last_ppage > zone->last_ppn)
+    last_ppage = zone->last_ppn;
 
-void _boot_physical_pages_init(ppn_t first_free_ppage, ppn_t last_free_ppage)
-{
-  _boot_first_free_ppn = first_free_ppage;
-  _boot_last_free_ppn  = last_free_ppage;
-} 
+#ifdef DEBUG
+  uint64_t start_tsc = rdtsc();
+#endif
 
-ppn_t _boot_physical_pages_alloc(size_t nbr_ppages)
+  _range_ppages_set_status(zone, first_ppage, last_ppage, PPAGE_STATUS_FREE);
+  zone->deferred_first_ppn = last_ppage + 1;
+
+#ifdef DEBUG
+  deferred_init_cycles += rdtsc() - start_tsc;
+  deferred_init_chunks++;
+#endif
+
+  return last_ppage - first_ppage + 1;
+}
+
+/* Change the migrate type of the pageblock of a page, and move the free
+ * blocks of this pageblock to the free lists of the new type.
+ */
+static void _zone_pageblock_claim(Physical_memory_zone *zone, ppn_t ppn, uint32_t migrate_type)
 {
-  ppn_t to_return = 0;
-  
-  if (_boot_first_free_ppn + nbr_ppages - 1 <= _boot_last_free_ppn)
-    {
-      to_return = _boot_first_free_ppn;
-      _boot_first_free_ppn += nbr_ppages;
-    }
-  else
+  Ppage *head = _zone_pageblock_head(zone, ppn);
+  ppn_t first_ppage = ppage_to_ppn(head);
+  ppn_t last_ppage = ppn | ((1UL << PPAGEBLOCK_ORDER) - 1);
+
+  if (last_ppage >= zone->deferred_first_ppn)
+    last_ppage = zone->deferred_first_ppn - 1;
+
+  //The free blocks are unlinked while the pageblock has its old type...
+  for (ppn_t i = first_ppage; i <= last_ppage;)
     {
-      panic("Can't allocate %lu physical page(s) in %s!\n", nbr_ppages,  __func__);
-    }
+      Ppage *ppage = ppn_to_ppage(i);
 
-  return to_return;
-}
+      if (ppage_is_block_head(ppage) == FALSE)
+	{
+	  i++;
+	  continue;
+	}
 
+      if (ppage_is_free(ppage))
+	_zone_free_list_delete(zone, ppage, ppage_block_order(ppage));
 
-void physical_page_boot_init(ppn_t first_ppage, ppn_t last_ppage)
-{
-  first_ppn = first_ppage;
-  last_ppn = last_ppage;
+      i += (1UL << ppage_block_order(ppage));
+    }
 
-  size_t nbr_pages_used_by_ppages_dscrs = ROUNDUP((last_ppage - first_ppage + 1) * sizeof(Ppage), PPAGE_SIZE) / PPAGE_SIZE;
+  _ppage_set_migrate_type(head, migrate_type);
 
-  ppn_t ppages_dscrs_ppn = _boot_physical_pages_alloc(nbr_pages_used_by_ppages_dscrs);
-  vpn_t ppages_dscrs_vpn = _boot_virtual_pages_alloc(nbr_pages_used_by_ppages_dscrs);
-  
-  ppages_dscrs = (Ppage*)vpn_to_vaddr(ppages_dscrs_vpn);
+  //...and linked again to the lists of its new type
+  for (ppn_t i = first_ppage; i <= last_ppage;)
+    {
+      Ppage *ppage = ppn_to_ppage(i);
 
-  kprintf("%s()\n", __func__);
-  kprintf("  ppages_dscrs physical size (in pages) : %u\n", nbr_pages_used_by_ppages_dscrs);
-  kprintf("  ppages_dscrs physical location : %p\n", ppn_to_paddr(ppages_dscrs_ppn));
-  kprintf("  ppages_dscrs virtual location : %p\n", ppages_dscrs);
-  kprintf("  first_ppage : %u\n", first_ppage);
-  kprintf("  last_ppage : %u\n", last_ppage);
-  kprintf("  Size of struct Ppage : %u\n", sizeof(Ppage));
-  
-  map_pages(ppages_dscrs_ppn,
-	    ppages_dscrs_vpn,
-	    nbr_pages_used_by_ppages_dscrs,
-	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+      if (ppage_is_block_head(ppage) == FALSE)
+	{
+	  i++;
+	  continue;
+	}
 
-  //we set the first physical MB of the memory as reserved by the kernel
-  _range_ppages_set_status(0, paddr_to_ppn(1*MB)-1, PPAGE_STATUS_USED);
-  //mark as free the memory between the first MB and the kernel image
-  _range_ppages_set_status(paddr_to_ppn(1*MB), paddr_to_ppn(boot_pa_start) - 1, PPAGE_STATUS_FREE);
-  //we mark as used the image of the kernel
-  _range_ppages_set_status(paddr_to_ppn(boot_pa_start), paddr_to_ppn(ROUNDUP(kernel_pa_end, PPAGE_SIZE)) - 1, PPAGE_STATUS_USED);
-  //we mark as used the memory allocated by the boot physical memory allocator
-  _range_ppages_set_status(paddr_to_ppn(kernel_pa_end), _boot_first_free_ppn - 1, PPAGE_STATUS_USED);
-  //mark as free the memory after
-  _range_ppages_set_status(_boot_first_free_ppn, last_ppage, PPAGE_STATUS_FREE);
-  kprintf("  Kernel's pages : [%u , %u]\n",paddr_to_ppn(boot_pa_start), paddr_to_ppn(ROUNDUP(kernel_pa_end, PPAGE_SIZE)) - 1);
-  kprintf("  Pages allocated during boot : [%u , %u]\n", paddr_to_ppn(kernel_pa_end), _boot_first_free_ppn - 1, PPAGE_STATUS_USED);
-  kprintf("  Free pages : [%u , %u]\n",  _boot_first_free_ppn, last_ppage, PPAGE_STATUS_FREE);
-}
+      if (ppage_is_free(ppage))
+	_zone_free_list_push(zone, ppage, ppage_block_order(ppage));
 
+      i += (1UL << ppage_block_order(ppage));
+    }
+}
 
-ppn_t ppage_block_alloc(uint32_t order)
+/* Find a free block for a migrate type which has none left, in the free lists
+ * of its fallback types.
+ * The biggest block is taken: the pageblocks of the other types are split as
+ * little as possible. The whole pageblock is claimed for the requested type
+ * when the block is big enough or when the type is not movable, so that the
+ * next allocations of this type are grouped in the same pageblock.
+ * Return NULL if no fallback type has a block big enough.
+ */
+static Ppage *_zone_fallback_block(Physical_memory_zone *zone, uint32_t order,
+				   uint32_t migrate_type, uint32_t *block_order)
 {
-  Ppage *to_return = _ppage_block_alloc(order);
+  for (uint32_t i = 0; i < PPAGE_MIGRATE_TYPES - 1; i++)
+    {
+      uint32_t fallback_type = migrate_fallbacks[migrate_type][i];
+      uint32_t available_orders = zone->free_orders_bitmap[fallback_type] & ~((1UL << order) - 1);
 
-  if (to_return == NULL)
-    panic("Failed to allocate a block of physical ppages in %s\n", __func__);
+      if (available_orders == 0)
+	continue;
 
-  return ppage_to_ppn(to_return);
-}
+      *block_order = most_significant_bit_index(available_orders);
+      Ppage *block = zone->free_ppages_blocks_clists[fallback_type][*block_order];
 
+      //At least half a pageblock
+      if (*block_order >= PPAGEBLOCK_ORDER - 1 || migrate_type != PPAGE_MIGRATE_MOVABLE)
+	_zone_pageblock_claim(zone, ppage_to_ppn(block), migrate_type);
 
-/*Try to allocate a block of physical contiguous pages of a given order.
-  Return a pointer to Ppage structure of the first ppage of the block if successful
-  NULL otherwise*/
-Ppage *_ppage_block_alloc(uint32_t order)
+      return block;
+    }
+
+  return NULL;
+}
+
+/* Remove a free block of the given order and migrate type from the free lists
+ * of a zone.
+ * The smallest available order is found with a bit-scan of the bitmap of
+ * non-empty orders, then the block is split down to the requested order.
+ * When the type has no block big enough, one is taken from the fallback
+ * types, then the deferred pages of the zone are initialised chunk by chunk
+ * until one is found.
+ * Return NULL if the zone has no block big enough.
+ */
+static Ppage *_zone_block_pop(Physical_memory_zone *zone, uint32_t order, uint32_t migrate_type)
 {
-  KASSERT(order < MAX_PPAGE_BLOCK_ORDER);
-  
-  Ppage *to_return = NULL;
+  Ppage *block;
+  uint32_t block_order;
 
-  if (clist_is_empty(free_ppages_blocks_clists[order]))
+  for (;;)
     {
-      Ppage *bigger_block = _ppage_block_alloc(order+1);
+      //Orders which are big enough and have at least a free block
+      uint32_t available_orders = zone->free_orders_bitmap[migrate_type] & ~((1UL << order) - 1);
 
-      if (bigger_block != NULL)
+      if (available_orders != 0)
 	{
-	  //we split the bigger_block in two
-	  
-	  Ppage *upper_part = ppn_to_ppage(ppage_to_ppn(bigger_block) + (ppn_t)(1 << order));
-	  upper_part->block_head = TRUE;
-	  upper_part->block_order = order;
-
-	  //we release the upper (unused) part
-	  _ppage_set_free(upper_part);
-	  clist_push_tail(free_ppages_blocks_clists[order], upper_part);
-	  
-	  bigger_block->block_order--;
-	  clist_push_tail(used_ppages_blocks_clists[order], bigger_block);
-	  to_return = bigger_block;
+	  block_order = least_significant_bit_index(available_orders);
+	  block = zone->free_ppages_blocks_clists[migrate_type][block_order];
+	  break;
 	}
+
+      block = _zone_fallback_block(zone, order, migrate_type, &block_order);
+
+      if (block != NULL)
+	break;
+
+      if (_zone_deferred_init_chunk(zone) == 0)
+	return NULL;
     }
-  else
+
+  _zone_free_list_delete(zone, block, block_order);
+
+  while (block_order > order)
     {
-      to_return = clist_pop_head(free_ppages_blocks_clists[order]);
-      clist_push_tail(used_ppages_blocks_clists[order], to_return);     
-      _ppage_set_used(to_return);
+      block_order--;
+      
+      //we split the block in two and release the upper (unused) part
+      Ppage *upper_part = ppn_to_ppage(ppage_to_ppn(block) + (ppn_t)(1UL << block_order));
+      _ppage_set_block_head(upper_part, block_order);
+      _ppage_set_free(upper_part);
+      _zone_free_list_push(zone, upper_part, block_order);
     }
 
-
-  return to_return;
+  _ppage_set_block_head(block, order);
   
+  return block;
 }
 
 
-void ppage_block_free(ppn_t ppn, uint32_t order)
-{
-  _ppage_block_free(ppn_to_ppage(ppn), order);
-}
-
-void _ppage_block_free(Ppage *block, uint32_t order)
+/* Give back a block to the free lists of its zone and merge it with its
+ * buddies as much as possible.
+ * The block must have been removed from the used lists by the caller.
+ */
+static void _zone_block_push(Physical_memory_zone *zone, Ppage *block, uint32_t order)
 {
-  KASSERT(block != NULL);
-  KASSERT(block->block_head == TRUE);
-  KASSERT(block->block_order == order);
-  KASSERT(block->block_order < MAX_PPAGE_BLOCK_ORDER);
-  KASSERT(ppage_count(block) == 1);
-
-  KASSERT(block->mapping == (vaddr_t)NULL);
-  KASSERT(block->slab == NULL);
-  
-  clist_delete_el(used_ppages_blocks_clists[order], block);
   _ppage_set_free(block);
 
+  zone->free_pages_count += (1UL << order);
+  zone->used_pages_count -= (1UL << order);
+
   //We try to merge as much as possible blocks
   while (order < (MAX_PPAGE_BLOCK_ORDER - 1))
     {
-      ppn_t buddy_ppn = find_buddy(ppage_to_ppn(block), block->block_order);
+      ppn_t buddy_ppn = find_buddy(ppage_to_ppn(block), order);
+
+      //A buddy outside of the zone (hole or other zone) or not initialised can't be merged
+      if (buddy_ppn < zone->first_ppn || buddy_ppn >= zone->deferred_first_ppn)
+	break;
+      
       Ppage *buddy = ppn_to_ppage(buddy_ppn);
 
       if (ppage_is_free(buddy) &&
-	  buddy->block_head == TRUE &&
-	  buddy->block_order == order)
+	  ppage_is_block_head(buddy) &&
+	  ppage_block_order(buddy) == order)
 	{
-	  clist_delete_el(free_ppages_blocks_clists[order], buddy);
-	  block->block_head = FALSE;
-	  buddy->block_head = FALSE;
+	  _zone_free_list_delete(zone, buddy, order);
+	  _ppage_clear_block_head(block);
+	  _ppage_clear_block_head(buddy);
+	  buddy->flags &= ~PPAGE_FREE;
+	  block->flags &= ~PPAGE_FREE;
 	  ppn_t merged_block_ppn = ppage_to_ppn(block) & buddy_ppn;
 	  Ppage *merged_block = ppn_to_ppage(merged_block_ppn);
-	  merged_block->block_head = TRUE;
 	  order++;
-	  merged_block->block_order = order;
+	  _ppage_set_block_head(merged_block, order);
+	  merged_block->flags |= PPAGE_FREE;
 
 	  block = merged_block;
 	}
@@ -374,57 +546,1553 @@ void _ppage_block_free(Ppage *block, uint32_t order)
 	}
     }
   
-  clist_push_tail(free_ppages_blocks_clists[order], block);
+  _zone_free_list_push(zone, block, order);
 }
 
-ppn_t ppage_alloc(void)
+/* Give back the used pages in [first_ppage, last_ppage] to the buddy
+ * allocator as the biggest possible aligned blocks.
+ * The pages must belong to a single zone and must not be block heads,
+ * except first_ppage.
+ */
+static void _range_ppages_release(ppn_t first_ppage, ppn_t last_ppage)
 {
-  return ppage_block_alloc(0);
+  Physical_memory_zone *zone = ppn_to_zone(first_ppage);
+  KASSERT(zone != NULL);
+  KASSERT(last_ppage <= zone->last_ppn);
+  
+  for (ppn_t ppn = first_ppage; ppn <= last_ppage;)
+    {
+      uint32_t order = MAX_PPAGE_BLOCK_ORDER - 1;
+
+      while (!is_buddy_block(ppn, order) || ppn + (1UL << order) - 1 > last_ppage)
+	order--;
+
+      Ppage *block = ppn_to_ppage(ppn);
+      _ppage_set_block_head(block, order);
+      _zone_block_push(zone, block, order);
+
+      ppn += (1UL << order);
+    }
 }
 
-Ppage *_ppage_alloc(void)
+/* Return the smallest order of a block containing nbr_ppages pages*/
+static uint32_t _ppages_order_of(size_t nbr_ppages)
 {
-  return _ppage_block_alloc(0);
+  if (nbr_ppages > (1UL << (MAX_PPAGE_BLOCK_ORDER - 1)))
+    panic("Try to allocate %u physical pages in %s, the biggest block has %u pages\n",
+	  nbr_ppages, __func__, 1UL << (MAX_PPAGE_BLOCK_ORDER - 1));
+
+  if (nbr_ppages <= 1)
+    return 0;
+
+  return most_significant_bit_index(nbr_ppages - 1) + 1;
 }
 
-void ppage_free(ppn_t ppn)
+/* Number of free pages of a zone, including the pages whose descriptors are
+ * not initialised yet.
+ */
+static inline uint32_t _zone_free_ppages(const Physical_memory_zone *zone)
 {
-  _ppage_free(ppn_to_ppage(ppn));
+  return zone->free_pages_count + (zone->last_ppn + 1 - zone->deferred_first_ppn);
 }
 
-void _ppage_free(Ppage *ppage)
+/* Return TRUE if a zone still has more free pages than the given watermark
+ * after the allocation of a block of the given order.
+ */
+static inline bool_t _zone_watermark_ok(const Physical_memory_zone *zone, uint32_t order, uint32_t watermark)
 {
-  _ppage_block_free(ppage,0);
+  uint32_t free_ppages = _zone_free_ppages(zone);
+
+  return (free_ppages >= (1UL << order) &&
+	  free_ppages - (1UL << order) >= zone->watermarks[watermark] + zone->reserved_ppages) ? TRUE : FALSE;
 }
 
-ppn_t ppages_alloc(size_t nbr_ppages)
+/* Run the shrinkers to free at least nbr_ppages pages and bring the zones back
+ * to their high watermark.
+ * Return the number of pages freed.
+ */
+static uint32_t _ppages_reclaim(uint32_t nbr_ppages)
 {
-  uint32_t order;
-  
-  if (nbr_ppages >= (1UL << MAX_PPAGE_BLOCK_ORDER))
-    panic("Try to allocate more that (1 << MAX_PPAGE_BLOCK_ORDER) physical pages in %s\n", __func__);
+  //A shrinker which allocates pages must not run the shrinkers again
+  if (ppages_reclaiming == TRUE)
+    return 0;
+
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      Physical_memory_zone *zone = &memory_zones[i];
+      uint32_t free_ppages = _zone_free_ppages(zone);
+
+      if (free_ppages < zone->watermarks[PPAGES_WATERMARK_HIGH])
+	nbr_ppages += zone->watermarks[PPAGES_WATERMARK_HIGH] - free_ppages;
+    }
+
+  ppages_reclaiming = TRUE;
+  uint32_t nbr_freed = shrinkers_run(nbr_ppages);
+  ppages_reclaiming = FALSE;
+
+  return nbr_freed;
+}
+
+/* Try to allocate a block of the given order from the buddy lists of the
+ * zones which stay above the given watermark.
+ * The zones of the higher addresses are used first to preserve the low memory.
+ */
+static Ppage *_zones_block_alloc(uint32_t order, uint32_t migrate_type, uint32_t watermark)
+{
+  Ppage *to_return = NULL;
+
+  for (uint32_t i = memory_zones_count; i > 0 && to_return == NULL; i--)
+    {
+      Physical_memory_zone *zone = &memory_zones[i - 1];
+
+      if ((_zone_free_orders(zone) >> order) == 0 &&
+	  zone->deferred_first_ppn > zone->last_ppn)
+	continue;
+
+      if (_zone_watermark_ok(zone, order, watermark) == FALSE)
+	continue;
+
+      to_return = _zone_block_pop(zone, order, migrate_type);
+
+      if (to_return != NULL)
+	{
+	  _ppage_set_used(to_return);
+
+	  zone->free_pages_count -= (1UL << order);
+	  zone->used_pages_count += (1UL << order);
+	}
+    }
+
+  return to_return;
+}
 
-  for (order = 0; order < MAX_PPAGE_BLOCK_ORDER; order++)
+/* Try to allocate a block of the given order without going under the low
+ * watermark of the zones. When the memory is low, the shrinkers are run and
+ * the block may be taken down to the min watermark, with a bounded number of
+ * retries.
+ */
+static Ppage *_buddy_block_alloc(uint32_t order, uint32_t migrate_type)
+{
+  Ppage *to_return = _zones_block_alloc(order, migrate_type, PPAGES_WATERMARK_LOW);
+
+  for (uint32_t retry = 0; to_return == NULL && retry < PPAGES_RECLAIM_RETRIES; retry++)
     {
-      if (nbr_ppages <= (1UL << order))
+      uint32_t nbr_freed = _ppages_reclaim(1UL << order);
+
+      to_return = _zones_block_alloc(order, migrate_type, PPAGES_WATERMARK_MIN);
+
+      //No progress is possible anymore
+      if (nbr_freed == 0)
 	break;
     }
-  
-  return ppage_block_alloc(order);
+
+  return to_return;
 }
 
-void ppages_set_slab(ppn_t ppn, uint32_t nbr_pages, const Slab *slab)
+/* Fill an empty CPU cache with a batch of cold pages from the buddy lists.
+ * The CPU caches serve the unmovable single pages.
+ */
+static void _ppages_cpu_cache_refill(Ppages_cpu_cache *cache)
 {
-  KASSERT(ppn <= last_ppn);
-  KASSERT(ppn + nbr_pages - 1 <= last_ppn);
-  KASSERT(slab != NULL);
-  KASSERT(slab->vregion != NULL);
-  KASSERT(slab->vregion->nbr_pages == nbr_pages);
+  for (uint32_t i = memory_zones_count; i > 0 && cache->count < cache->batch; i--)
+    {
+      Physical_memory_zone *zone = &memory_zones[i - 1];
 
-  for(uint32_t i = 1; i <= nbr_pages; i++)
+      while (cache->count < cache->batch &&
+	     _zone_watermark_ok(zone, 0, PPAGES_WATERMARK_LOW) == TRUE)
+	{
+	  Ppage *ppage = _zone_block_pop(zone, 0, PPAGE_MIGRATE_UNMOVABLE);
+
+	  if (ppage == NULL)
+	    break;
+
+	  _ppage_set_used(ppage);
+	  zone->free_pages_count--;
+	  zone->used_pages_count++;
+	  
+	  clist_push_tail(cache->ppages, ppage);
+	  cache->count++;
+	}
+    }
+}
+
+/* Give back the coldest pages of a CPU cache to the buddy lists until the cache
+ * holds at most nbr_ppages pages.
+ */
+static void _ppages_cpu_cache_shrink(Ppages_cpu_cache *cache, uint32_t nbr_ppages)
+{
+  while (cache->count > nbr_ppages)
     {
-      _ppage_set_slab(ppn_to_ppage(ppn), slab);
-      ppn++;
+      Ppage *ppage = cache->ppages->prev;
+      clist_delete_el(cache->ppages, ppage);
+      cache->count--;
+
+      Physical_memory_zone *zone = ppn_to_zone(ppage_to_ppn(ppage));
+      KASSERT(zone != NULL);
+      _zone_block_push(zone, ppage, 0);
+    }
+}
+
+/* Fill a physical page with zeros, through the zeroing window.*/
+static void _ppage_zero(Ppage *ppage)
+{
+  vaddr_t window = vpn_to_vaddr(zeroing_window_vpn);
+
+  map_page(ppage_to_ppn(ppage), zeroing_window_vpn, PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR);
+  memset((void*)window, 0, PPAGE_SIZE);
+  unmap_page(zeroing_window_vpn);
+}
+
+/* Fill the colour lists of a CPU cache with a block of ppages_colours pages:
+ * the block is aligned on its size, so it holds exactly a page of each colour.
+ * The pages of the colours whose list is full are released.
+ * The colours are only a hint: nothing is reclaimed for such a block.
+ */
+static void _ppages_colours_refill(Ppages_cpu_cache *cache)
+{
+  Ppage *block = _zones_block_alloc(ppages_colours_order, PPAGE_MIGRATE_UNMOVABLE, PPAGES_WATERMARK_LOW);
+
+  if (block == NULL)
+    return;
+
+  for (uint32_t colour = 0; colour < ppages_colours; colour++)
+    {
+      Ppage *ppage = block + colour;
+      _ppage_set_block_head(ppage, 0);
+      _ppage_set_used(ppage);
+
+      if (cache->colours_counts[colour] < PPAGES_COLOUR_CACHE_HIGH)
+	{
+	  clist_push_tail(cache->colours_ppages[colour], ppage);
+	  cache->colours_counts[colour]++;
+	}
+      else
+	{
+	  _ppage_free(ppage);
+	}
     }
 }
 
+/* Split the zone which contains the given page, so that the page is the first
+ * page of a zone.
+ */
+static void _zones_split(ppn_t ppn)
+{
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      if (memory_zones[i].first_ppn < ppn && ppn <= memory_zones[i].last_ppn)
+	{
+	  if (memory_zones_count == MAX_PHYSICAL_MEMORY_ZONES)
+	    panic("Too many physical memory zones in %s!\n", __func__);
+
+	  for (uint32_t j = memory_zones_count; j > i + 1; j--)
+	    memory_zones[j] = memory_zones[j - 1];
+
+	  memory_zones[i + 1].first_ppn = ppn;
+	  memory_zones[i + 1].last_ppn  = memory_zones[i].last_ppn;
+	  memory_zones[i].last_ppn = ppn - 1;
+	  memory_zones_count++;
+
+	  return;
+	}
+    }
+}
+
+/* Return the free block of a zone which contains the given page, NULL if
+ * the page is used. The order of the block is stored in order.
+ */
+static Ppage *_zone_free_block_of(const Physical_memory_zone *zone, ppn_t ppn, uint32_t *order)
+{
+  if (ppn >= zone->deferred_first_ppn)
+    return NULL;
+
+  for (uint32_t i = 0; i < MAX_PPAGE_BLOCK_ORDER; i++)
+    {
+      ppn_t head_ppn = ppn & ~((1UL << i) - 1);
+
+      if (head_ppn < zone->first_ppn)
+	break;
+
+      Ppage *head = ppn_to_ppage(head_ppn);
+
+      if (ppage_is_free(head) && ppage_is_block_head(head) && ppage_block_order(head) == i)
+	{
+	  *order = i;
+	  return head;
+	}
+    }
+
+  return NULL;
+}
+
+/* Look for nbr_ppages free pages in a zone, the first one aligned on
+ * align_ppages pages, the last one not above max_ppn and all of them in the
+ * same boundary_ppages pages (0 for no boundary).
+ * Return TRUE and store the first page in first_ppage if they are found.
+ */
+static bool_t _zone_range_find(Physical_memory_zone *zone, size_t nbr_ppages, ppn_t max_ppn,
+			       ppn_t align_ppages, ppn_t boundary_ppages, ppn_t *first_ppage)
+{
+  ppn_t last_allowed_ppn = MIN(zone->last_ppn, max_ppn);
+  ppn_t candidate = ROUNDUP(zone->first_ppn, align_ppages);
+
+  //Every descriptor of the range must be initialised
+  while (zone->deferred_first_ppn <= last_allowed_ppn &&
+	 _zone_deferred_init_chunk(zone) > 0)
+    ;
+
+  while (candidate <= last_allowed_ppn && nbr_ppages - 1 <= last_allowed_ppn - candidate)
+    {
+      ppn_t last_ppage = candidate + nbr_ppages - 1;
+
+      //The range must not cross a boundary: we go to the next one
+      if (boundary_ppages != 0 && ((candidate ^ last_ppage) & ~(boundary_ppages - 1)) != 0)
+	{
+	  ppn_t next_boundary = last_ppage & ~(boundary_ppages - 1);
+	  candidate = ROUNDUP(next_boundary, align_ppages);
+	  continue;
+	}
+
+      //The free blocks of the range are skipped at once
+      ppn_t ppn = candidate;
+
+      while (ppn <= last_ppage)
+	{
+	  uint32_t order;
+	  Ppage *block = _zone_free_block_of(zone, ppn, &order);
+
+	  if (block == NULL)
+	    break;
+
+	  ppn = ppage_to_ppn(block) + (ppn_t)(1UL << order);
+	}
+
+      if (ppn > last_ppage)
+	{
+	  *first_ppage = candidate;
+	  return TRUE;
+	}
+
+      //The page ppn is used, the next candidate starts after it
+      ppn++;
+      candidate = ROUNDUP(ppn, align_ppages);
+    }
+
+  return FALSE;
+}
+
+/* Take the free pages [first_ppage, last_ppage] out of the buddy lists of a
+ * zone. The free blocks which contain them are removed, and their parts out
+ * of the range are given back.
+ * The first page becomes the head of a block of order 0, the other ones are
+ * used pages which belong to no block.
+ */
+static void _zone_range_carve(Physical_memory_zone *zone, ppn_t first_ppage, ppn_t last_ppage)
+{
+  for (ppn_t ppn = first_ppage; ppn <= last_ppage;)
+    {
+      uint32_t order;
+      Ppage *block = _zone_free_block_of(zone, ppn, &order);
+      KASSERT(block != NULL);
+
+      ppn_t block_first_ppn = ppage_to_ppn(block);
+      ppn_t block_last_ppn  = block_first_ppn + (ppn_t)(1UL << order) - 1;
+
+      _zone_free_list_delete(zone, block, order);
+      _ppage_clear_block_head(block);
+
+      zone->free_pages_count -= (1UL << order);
+      zone->used_pages_count += (1UL << order);
+
+      for (ppn_t i = block_first_ppn; i <= block_last_ppn; i++)
+	_ppage_set_used(ppn_to_ppage(i));
+
+      if (block_first_ppn < first_ppage)
+	_range_ppages_release(block_first_ppn, first_ppage - 1);
+
+      if (block_last_ppn > last_ppage)
+	_range_ppages_release(last_ppage + 1, block_last_ppn);
+
+      ppn = block_last_ppn + 1;
+    }
+
+  _ppage_set_block_head(ppn_to_ppage(first_ppage), 0);
+}
+
+/* Sort an array of page numbers in increasing order (Shell sort).*/
+static void _ppns_sort(ppn_t *ppns, uint32_t nbr_ppns)
+{
+  uint32_t gap = 1;
+
+  while (gap < nbr_ppns / 3)
+    gap = gap * 3 + 1;
+
+  for (; gap > 0; gap /= 3)
+    {
+      for (uint32_t i = gap; i < nbr_ppns; i++)
+	{
+	  ppn_t ppn = ppns[i];
+	  uint32_t j = i;
+
+	  for (; j >= gap && ppns[j - gap] > ppn; j -= gap)
+	    ppns[j] = ppns[j - gap];
+
+	  ppns[j] = ppn;
+	}
+    }
+}
+
+/* Shrinker of the CPU caches: all their pages are given back to the buddy lists.*/
+static uint32_t _ppages_cpu_caches_shrink(uint32_t nbr_ppages)
+{
+  uint32_t nbr_freed = 0;
+
+  (void)nbr_ppages;
+
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+      Ppages_cpu_cache *cache = &ppages_cpu_caches[cpu];
+
+      nbr_freed += cache->count;
+
+      for (uint32_t colour = 0; colour < ppages_colours; colour++)
+	nbr_freed += cache->colours_counts[colour];
+
+      ppages_cpu_cache_drain(cpu);
+    }
+
+  return nbr_freed;
+}
+
+/* Shrinker of the pool of zeroed pages.*/
+static uint32_t _zeroed_pool_shrink(uint32_t nbr_ppages)
+{
+  uint32_t nbr_freed = 0;
+
+  while (zeroed_ppages_count > 0 && nbr_freed < nbr_ppages)
+    {
+      Ppage *ppage = zeroed_ppages->prev;
+      clist_delete_el(zeroed_ppages, ppage);
+      zeroed_ppages_count--;
+
+      Physical_memory_zone *zone = ppn_to_zone(ppage_to_ppn(ppage));
+      KASSERT(zone != NULL);
+      _zone_block_push(zone, ppage, 0);
+
+      nbr_freed++;
+    }
+
+  return nbr_freed;
+}
+
+static Shrinker ppages_cpu_caches_shrinker = {"ppages_cpu_caches", _ppages_cpu_caches_shrink, NULL, NULL};
+static Shrinker zeroed_pool_shrinker = {"zeroed_ppages_pool", _zeroed_pool_shrink, NULL, NULL};
+
+
+
+/**************************************************
+               Public functions
+**************************************************/
+
+
+void _boot_physical_pages_init(ppn_t first_free_ppage, ppn_t last_free_ppage)
+{
+  _boot_first_free_ppn = first_free_ppage;
+  _boot_last_free_ppn  = last_free_ppage;
+} 
+
+ppn_t _boot_physical_pages_alloc(size_t nbr_ppages)
+{
+  ppn_t to_return = 0;
+  
+  if (_boot_first_free_ppn + nbr_ppages - 1 <= _boot_last_free_ppn)
+    {
+      to_return = _boot_first_free_ppn;
+      _boot_first_free_ppn += nbr_ppages;
+    }
+  else
+    {
+      panic("Can't allocate %lu physical page(s) in %s!\n", nbr_ppages,  __func__);
+    }
+
+  return to_return;
+}
+
+
+/**
+ * \fn void physical_memory_zone_add(paddr_t start, paddr_t end)
+ * \brief Declare a range of usable RAM (usually reported by the bootloader).
+ * \param start Physical address of the first byte of the range.
+ * \param end Physical address of the last byte of the range.
+ *
+ * Only the pages fully included in the range are used. Overlapping or
+ * adjacent ranges are merged in a single zone.
+ * Must be called before physical_page_boot_init().
+ */
+void physical_memory_zone_add(paddr_t start, paddr_t end)
+{
+  KASSERT(ppages_initialized == FALSE);
+
+  if (start > end)
+    return;
+
+  ppn_t first_ppage = paddr_to_ppn(start) + ((start & PPAGE_MASK) ? 1 : 0);
+  ppn_t last_ppage  = paddr_to_ppn(end);
+
+  if (((end + 1) & PPAGE_MASK) != 0)
+    {
+      if (last_ppage == 0)
+	return;
+      last_ppage--;
+    }
+
+  if (first_ppage > last_ppage)
+    return;
+
+  //We look for the position of the new zone and merge it with its neighbours if possible
+  uint32_t i = 0;
+
+  while (i < memory_zones_count && memory_zones[i].last_ppn + 1 < first_ppage)
+    i++;
+
+  if (i < memory_zones_count && memory_zones[i].first_ppn <= last_ppage + 1)
+    {
+      memory_zones[i].first_ppn = MIN(memory_zones[i].first_ppn, first_ppage);
+      memory_zones[i].last_ppn  = MAX(memory_zones[i].last_ppn, last_ppage);
+
+      //The extended zone may now reach the following ones
+      while (i + 1 < memory_zones_count && memory_zones[i + 1].first_ppn <= memory_zones[i].last_ppn + 1)
+	{
+	  memory_zones[i].last_ppn = MAX(memory_zones[i].last_ppn, memory_zones[i + 1].last_ppn);
+
+	  for (uint32_t j = i + 1; j + 1 < memory_zones_count; j++)
+	    memory_zones[j] = memory_zones[j + 1];
+	  memory_zones_count--;
+	}
+    }
+  else
+    {
+      if (memory_zones_count == MAX_PHYSICAL_MEMORY_ZONES)
+	panic("Too many physical memory zones in %s!\n", __func__);
+
+      for (uint32_t j = memory_zones_count; j > i; j--)
+	memory_zones[j] = memory_zones[j - 1];
+
+      memory_zones[i].first_ppn = first_ppage;
+      memory_zones[i].last_ppn  = last_ppage;
+      memory_zones_count++;
+    }
+}
+
+/**
+ * \fn Physical_memory_zone *ppn_to_zone(ppn_t ppn)
+ * \brief Return the memory zone which contains the given physical page.
+ * \param ppn Number of the physical page.
+ * \return The memory zone, NULL if the page is not usable RAM.
+ */
+Physical_memory_zone *ppn_to_zone(ppn_t ppn)
+{
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      if (memory_zones[i].first_ppn <= ppn && ppn <= memory_zones[i].last_ppn)
+	return &memory_zones[i];
+    }
+
+  return NULL;
+}
+
+/**
+ * \fn bool_t physical_pages_initialized(void)
+ * \return TRUE once the buddy allocator can be used, FALSE while only the
+ *         boot allocator is available.
+ */
+bool_t physical_pages_initialized(void)
+{
+  return ppages_initialized;
+}
+
+void physical_page_boot_init(void)
+{
+  if (memory_zones_count == 0)
+    panic("No usable physical memory in %s!\n", __func__);
+  
+  first_ppn = 0;
+  last_ppn = memory_zones[memory_zones_count - 1].last_ppn;
+
+  //The memory below PPAGES_DMA_LIMIT is kept in its own zone
+  _zones_split(paddr_to_ppn(PPAGES_DMA_LIMIT));
+
+  size_t nbr_pages_used_by_ppages_dscrs = ROUNDUP((last_ppn - first_ppn + 1) * sizeof(Ppage), PPAGE_SIZE) / PPAGE_SIZE;
+
+  ppn_t ppages_dscrs_ppn = _boot_physical_pages_alloc(nbr_pages_used_by_ppages_dscrs);
+  vpn_t ppages_dscrs_vpn = _boot_virtual_pages_alloc(nbr_pages_used_by_ppages_dscrs);
+  
+  ppages_dscrs = (Ppage*)vpn_to_vaddr(ppages_dscrs_vpn);
+
+  kprintf("%s()\n", __func__);
+  kprintf("  ppages_dscrs physical size (in pages) : %u\n", nbr_pages_used_by_ppages_dscrs);
+  kprintf("  ppages_dscrs physical location : %p\n", ppn_to_paddr(ppages_dscrs_ppn));
+  kprintf("  ppages_dscrs virtual location : %p\n", ppages_dscrs);
+  kprintf("  first_ppn : %u\n", first_ppn);
+  kprintf("  last_ppn : %u\n", last_ppn);
+  kprintf("  Size of struct Ppage : %u\n", sizeof(Ppage));
+  
+  map_pages(ppages_dscrs_ppn,
+	    ppages_dscrs_vpn,
+	    nbr_pages_used_by_ppages_dscrs,
+	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+
+  /* The page table of the zeroing window is allocated now, by the boot
+   * allocator: afterwards, mapping the window must never need a new page.
+   */
+  zeroing_window_vpn = _boot_virtual_pages_alloc(1);
+  map_page(ppages_dscrs_ppn, zeroing_window_vpn, PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR);
+  unmap_page(zeroing_window_vpn);
+
+  /* Every page below _boot_first_free_ppn is used: the first MB of the memory
+   * (BIOS, bootloader information...), the image of the kernel and the memory
+   * allocated by the boot physical memory allocator.
+   * The holes between the zones are reserved.
+   */
+  ppn_t next_ppn = first_ppn;
+  uint32_t nbr_deferred_ppages = 0;
+  uint64_t start_tsc = rdtsc();
+  
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      Physical_memory_zone *zone = &memory_zones[i];
+
+      zone->pages_count        = zone->last_ppn - zone->first_ppn + 1;
+      zone->free_pages_count   = 0;
+      zone->used_pages_count   = 0;
+      zone->deferred_first_ppn = zone->last_ppn + 1;
+
+      zone->watermarks[PPAGES_WATERMARK_MIN]  = zone->pages_count / PPAGES_WATERMARK_MIN_RATIO;
+      zone->watermarks[PPAGES_WATERMARK_LOW]  = zone->watermarks[PPAGES_WATERMARK_MIN] * 5 / 4;
+      zone->watermarks[PPAGES_WATERMARK_HIGH] = zone->watermarks[PPAGES_WATERMARK_MIN] * 3 / 2;
+
+      //The general allocations may use the whole DMA zone if there is no memory above it
+      if (zone->last_ppn < paddr_to_ppn(PPAGES_DMA_LIMIT) &&
+	  memory_zones[memory_zones_count - 1].last_ppn >= paddr_to_ppn(PPAGES_DMA_LIMIT))
+	zone->reserved_ppages = zone->pages_count / PPAGES_DMA_RESERVE_RATIO;
+      else
+	zone->reserved_ppages = 0;
+
+      for (uint32_t type = 0; type < PPAGE_MIGRATE_TYPES; type++)
+	{
+	  zone->free_orders_bitmap[type] = 0;
+	  
+	  for (uint32_t order = 0; order < MAX_PPAGE_BLOCK_ORDER; order++)
+	    {
+	      zone->free_ppages_blocks_clists[type][order] = NULL;
+	    }
+	}
+
+      if (next_ppn < zone->first_ppn)
+	_range_ppages_set_status(NULL, next_ppn, zone->first_ppn - 1, PPAGE_STATUS_USED);
+
+      if (zone->last_ppn < _boot_first_free_ppn)
+	{
+	  _range_ppages_set_status(zone, zone->first_ppn, zone->last_ppn, PPAGE_STATUS_USED);
+	}
+      else if (zone->first_ppn >= _boot_first_free_ppn)
+	{
+	  zone->deferred_first_ppn = zone->first_ppn;
+	}
+      else
+	{
+	  _range_ppages_set_status(zone, zone->first_ppn, _boot_first_free_ppn - 1, PPAGE_STATUS_USED);
+	  zone->deferred_first_ppn = _boot_first_free_ppn;
+	}
+
+      /* Only the first chunk of free pages is initialised now, the rest is
+       * initialised on demand by the buddy allocator or when the CPU is idle.
+       */
+      _zone_deferred_init_chunk(zone);
+      nbr_deferred_ppages += zone->last_ppn + 1 - zone->deferred_first_ppn;
+
+      next_ppn = zone->last_ppn + 1;
+
+      kprintf("  Zone %u : [%u , %u] - %u free page(s), %u deferred\n", i, zone->first_ppn, zone->last_ppn,
+	      zone->free_pages_count, zone->last_ppn + 1 - zone->deferred_first_ppn);
+    }
+
+  struct Cpu_cache_info l2_cache;
+
+  //A page colour is a group of sets of the L2 cache: the pages of different colours never collide
+  if (cpu_l2_cache_info(&l2_cache) == TRUE && l2_cache.associativity != 0)
+    {
+      uint32_t nbr_colours = l2_cache.size / (l2_cache.associativity * PPAGE_SIZE);
+
+      if (nbr_colours > PPAGES_MAX_COLOURS)
+	nbr_colours = PPAGES_MAX_COLOURS;
+
+      if (nbr_colours > (1UL << (MAX_PPAGE_BLOCK_ORDER - 1)))
+	nbr_colours = 1UL << (MAX_PPAGE_BLOCK_ORDER - 1);
+
+      if (nbr_colours > 1)
+	{
+	  ppages_colours_order = most_significant_bit_index(nbr_colours);
+	  ppages_colours = 1UL << ppages_colours_order;
+	}
+
+      kprintf("  L2 cache : %u KB, %u-way, %u B lines - %u page colour(s)\n",
+	      l2_cache.size / 1024, l2_cache.associativity, l2_cache.line_size, ppages_colours);
+    }
+
+  kprintf("  Descriptors initialised in %u cycles, %u page(s) deferred\n", (uint32_t)(rdtsc() - start_tsc), nbr_deferred_ppages);
+  
+  kprintf("  Kernel's pages : [%u , %u]\n",paddr_to_ppn(boot_pa_start), paddr_to_ppn(ROUNDUP(kernel_pa_end, PPAGE_SIZE)) - 1);
+  kprintf("  Pages allocated during boot : [%u , %u]\n", paddr_to_ppn(ROUNDUP(kernel_pa_end, PPAGE_SIZE)), _boot_first_free_ppn - 1);
+
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+      ppages_cpu_caches[cpu].count  = 0;
+      ppages_cpu_caches[cpu].high   = PPAGES_CPU_CACHE_HIGH;
+      ppages_cpu_caches[cpu].low    = PPAGES_CPU_CACHE_LOW;
+      ppages_cpu_caches[cpu].batch  = PPAGES_CPU_CACHE_BATCH;
+      ppages_cpu_caches[cpu].ppages = NULL;
+      ppages_cpu_caches[cpu].next_colour = 0;
+
+      for (uint32_t colour = 0; colour < PPAGES_MAX_COLOURS; colour++)
+	{
+	  ppages_cpu_caches[cpu].colours_counts[colour] = 0;
+	  ppages_cpu_caches[cpu].colours_ppages[colour] = NULL;
+	}
+    }
+
+  shrinker_register(&zeroed_pool_shrinker);
+  shrinker_register(&ppages_cpu_caches_shrinker);
+
+  ppages_initialized = TRUE;
+}
+
+
+ppn_t ppage_block_alloc(uint32_t order)
+{
+  Ppage *to_return = _ppage_block_alloc(order);
+
+  if (to_return == NULL)
+    panic("Failed to allocate a block of physical ppages in %s\n", __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+
+/*Try to allocate a block of physical contiguous pages of a given order.
+  Return a pointer to Ppage structure of the first ppage of the block if successful
+  NULL otherwise*/
+Ppage *_ppage_block_alloc(uint32_t order)
+{
+  return _ppage_block_alloc_type(order, PPAGE_MIGRATE_UNMOVABLE);
+}
+
+ppn_t ppage_block_alloc_type(uint32_t order, uint32_t migrate_type)
+{
+  Ppage *to_return = _ppage_block_alloc_type(order, migrate_type);
+
+  if (to_return == NULL)
+    panic("Failed to allocate a block of physical ppages in %s\n", __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+/*Same as _ppage_block_alloc() for a block whose content has the given
+  migrate type. The kernel's allocations are unmovable by default.*/
+Ppage *_ppage_block_alloc_type(uint32_t order, uint32_t migrate_type)
+{
+  KASSERT(order < MAX_PPAGE_BLOCK_ORDER);
+  KASSERT(migrate_type < PPAGE_MIGRATE_TYPES);
+
+  //Unmovable single pages are served by the per-CPU caches
+  if (order == 0 && migrate_type == PPAGE_MIGRATE_UNMOVABLE)
+    return _ppage_alloc();
+
+  return _buddy_block_alloc(order, migrate_type);
+}
+
+
+void ppage_block_free(ppn_t ppn, uint32_t order)
+{
+  _ppage_block_free(ppn_to_ppage(ppn), order);
+}
+
+void _ppage_block_free(Ppage *block, uint32_t order)
+{
+  KASSERT(block != NULL);
+  KASSERT(ppage_is_block_head(block) == TRUE);
+  KASSERT(ppage_block_order(block) == order);
+  KASSERT(order < MAX_PPAGE_BLOCK_ORDER);
+  KASSERT(ppage_count(block) == 1);
+
+  //NB: slab and mapping share the same field
+  KASSERT(block->mapping == (vaddr_t)NULL);
+
+  if (order == 0)
+    {
+      _ppage_free(block);
+    }
+  else
+    {
+      Physical_memory_zone *zone = ppn_to_zone(ppage_to_ppn(block));
+      KASSERT(zone != NULL);
+  
+      _zone_block_push(zone, block, order);
+    }
+}
+
+ppn_t ppage_alloc(void)
+{
+  return ppage_block_alloc(0);
+}
+
+Ppage *_ppage_alloc(void)
+{
+  Ppages_cpu_cache *cache = &ppages_cpu_caches[current_cpu_id()];
+  
+  if (cache->count == 0)
+    _ppages_cpu_cache_refill(cache);
+
+  //The zones are low on memory: the page is taken after a reclaim
+  if (cache->count == 0)
+    return _buddy_block_alloc(0, PPAGE_MIGRATE_UNMOVABLE);
+
+  //The hottest page is at the head of the cache
+  Ppage *ppage = clist_pop_head(cache->ppages);
+  cache->count--;
+
+  //The list links share their memory with the fields of a used page
+  _ppage_set_used(ppage);
+
+  return ppage;
+}
+
+void ppage_free(ppn_t ppn)
+{
+  _ppage_free(ppn_to_ppage(ppn));
+}
+
+void _ppage_free(Ppage *ppage)
+{
+  KASSERT(ppage != NULL);
+  KASSERT(ppage_is_block_head(ppage) == TRUE);
+  KASSERT(ppage_block_order(ppage) == 0);
+  KASSERT(ppage_count(ppage) == 1);
+
+  //NB: slab and mapping share the same field
+  KASSERT(ppage->mapping == (vaddr_t)NULL);
+  
+  Ppages_cpu_cache *cache = &ppages_cpu_caches[current_cpu_id()];
+
+  clist_push_head(cache->ppages, ppage);
+  cache->count++;
+
+  if (cache->count > cache->high)
+    _ppages_cpu_cache_shrink(cache, cache->low);
+}
+
+/**
+ * \fn void ppages_cpu_cache_drain(uint32_t cpu)
+ * \brief Give back all the pages of a CPU cache to the buddy allocator.
+ * \param cpu Index of the CPU whose cache is drained.
+ */
+void ppages_cpu_cache_drain(uint32_t cpu)
+{
+  KASSERT(cpu < MAX_CPUS);
+
+  Ppages_cpu_cache *cache = &ppages_cpu_caches[cpu];
+
+  for (uint32_t colour = 0; colour < ppages_colours; colour++)
+    {
+      while (cache->colours_counts[colour] > 0)
+	{
+	  Ppage *ppage = clist_pop_head(cache->colours_ppages[colour]);
+	  cache->colours_counts[colour]--;
+
+	  clist_push_tail(cache->ppages, ppage);
+	  cache->count++;
+	}
+    }
+  
+  _ppages_cpu_cache_shrink(cache, 0);
+}
+
+/**
+ * \fn uint32_t ppages_colours_count(void)
+ * \brief Return the number of page colours, 1 if the pages are not coloured.
+ */
+uint32_t ppages_colours_count(void)
+{
+  return ppages_colours;
+}
+
+/**
+ * \fn uint32_t ppage_colour_of(ppn_t ppn)
+ * \brief Return the colour of a physical page, i.e. the group of L2 cache
+ *        sets its content is stored in.
+ */
+uint32_t ppage_colour_of(ppn_t ppn)
+{
+  return ppn & (ppages_colours - 1);
+}
+
+ppn_t ppage_alloc_colour(uint32_t colour)
+{
+  Ppage *to_return = _ppage_alloc_colour(colour);
+
+  if (to_return == NULL)
+    panic("Failed to allocate a physical page in %s\n", __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+/*Allocate a single physical page of the given colour, or of the next colour
+  of the CPU if colour is PPAGE_NEXT_COLOUR: the pages allocated in a row
+  then use different sets of the L2 cache.
+  The colour is a hint: any page is returned when no page of this colour
+  is available, or when the pages are not coloured.*/
+Ppage *_ppage_alloc_colour(uint32_t colour)
+{
+  if (ppages_colours == 1)
+    return _ppage_alloc();
+
+  Ppages_cpu_cache *cache = &ppages_cpu_caches[current_cpu_id()];
+
+  if (colour == PPAGE_NEXT_COLOUR)
+    {
+      colour = cache->next_colour;
+      cache->next_colour = (colour + 1) & (ppages_colours - 1);
+    }
+
+  KASSERT(colour < ppages_colours);
+
+  if (cache->colours_counts[colour] == 0)
+    _ppages_colours_refill(cache);
+
+  if (cache->colours_counts[colour] == 0)
+    return _ppage_alloc();
+
+  Ppage *ppage = clist_pop_head(cache->colours_ppages[colour]);
+  cache->colours_counts[colour]--;
+
+  //The list links share their memory with the fields of a used page
+  _ppage_set_used(ppage);
+
+  return ppage;
+}
+
+ppn_t ppage_alloc_zeroed(void)
+{
+  Ppage *to_return = _ppage_alloc_zeroed();
+
+  if (to_return == NULL)
+    panic("Failed to allocate a zeroed physical page in %s\n", __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+/*Allocate a single physical page filled with zeros.
+  The page comes from the pool of zeroed pages, it is only zeroed on the
+  critical path when the pool is empty.*/
+Ppage *_ppage_alloc_zeroed(void)
+{
+  Ppage *ppage;
+
+  if (zeroed_ppages_count > 0)
+    {
+      ppage = clist_pop_head(zeroed_ppages);
+      zeroed_ppages_count--;
+
+      _ppage_set_used(ppage);
+    }
+  else
+    {
+      ppage = _ppage_alloc();
+
+      if (ppage != NULL)
+	_ppage_zero(ppage);
+    }
+
+  return ppage;
+}
+
+/**
+ * \fn uint32_t ppages_deferred_init(void)
+ * \brief Initialise the next chunk of deferred page descriptors.
+ * \return The number of pages given to the buddy allocator, 0 if every
+ *         descriptor is initialised.
+ *
+ * Meant to be called when the CPU is idle, so that the allocations rarely
+ * have to initialise the descriptors themselves.
+ */
+uint32_t ppages_deferred_init(void)
+{
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      uint32_t nbr_ppages = _zone_deferred_init_chunk(&memory_zones[i]);
+
+      if (nbr_ppages > 0)
+	return nbr_ppages;
+    }
+
+#ifdef DEBUG
+  static bool_t deferred_init_reported = FALSE;
+
+  //The chunks may be initialised by the allocations: the summary is printed here, once
+  if (deferred_init_reported == FALSE)
+    {
+      kprintf("%s: %u chunk(s) initialised in %u cycles\n", __func__,
+	      deferred_init_chunks, (uint32_t)deferred_init_cycles);
+      deferred_init_reported = TRUE;
+    }
+#endif
+
+  return 0;
+}
+
+/**
+ * \fn uint32_t ppages_balance_zones(void)
+ * \brief Run the shrinkers if every zone is under its low watermark.
+ * \return The number of pages freed.
+ *
+ * Meant to be called when the CPU is idle, so that the allocations rarely
+ * have to run the shrinkers themselves. A single zone above its low watermark
+ * is enough for the allocations, so small zones which are full (e.g. the
+ * memory below 1MB) do not trigger the shrinkers.
+ */
+uint32_t ppages_balance_zones(void)
+{
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      if (_zone_watermark_ok(&memory_zones[i], 0, PPAGES_WATERMARK_LOW) == TRUE)
+	return 0;
+    }
+
+  return _ppages_reclaim(0);
+}
+
+/**
+ * \fn uint32_t ppages_zeroed_pool_refill(void)
+ * \brief Zero some free pages in advance for ppage_alloc_zeroed().
+ * \return The number of pages zeroed, 0 if the pool is full or there is no
+ *         free page left.
+ *
+ * Meant to be called when the CPU is idle. At most PPAGES_ZEROED_POOL_BATCH
+ * pages are zeroed per call, so that pending work is not delayed for long.
+ * The pool is only refilled from the zones above their high watermark.
+ * The pages are taken from the buddy lists: the hot pages of the CPU caches
+ * are left to the allocations which overwrite their content anyway.
+ */
+uint32_t ppages_zeroed_pool_refill(void)
+{
+  uint32_t nbr_zeroed = 0;
+
+  while (nbr_zeroed < PPAGES_ZEROED_POOL_BATCH
+	 && zeroed_ppages_count < PPAGES_ZEROED_POOL_HIGH)
+    {
+      Ppage *ppage = _zones_block_alloc(0, PPAGE_MIGRATE_UNMOVABLE, PPAGES_WATERMARK_HIGH);
+
+      if (ppage == NULL)
+	break;
+
+      _ppage_zero(ppage);
+
+      clist_push_tail(zeroed_ppages, ppage);
+      zeroed_ppages_count++;
+      nbr_zeroed++;
+    }
+
+  return nbr_zeroed;
+}
+
+ppn_t ppages_alloc(size_t nbr_ppages)
+{
+  return ppage_block_alloc(_ppages_order_of(nbr_ppages));
+}
+
+/**
+ * \fn ppn_t ppages_alloc_exact(size_t nbr_ppages)
+ * \brief Allocate exactly nbr_ppages contiguous physical pages.
+ * \param nbr_ppages The number of pages to allocate.
+ * \return The number of the first allocated physical page.
+ *
+ * A block of the next power of two is allocated, its first nbr_ppages pages
+ * are kept as aligned blocks of decreasing orders (one per bit set in
+ * nbr_ppages) and the unused tail is given back to the buddy allocator.
+ * The pages must be released with ppages_free_exact().
+ */
+ppn_t ppages_alloc_exact(size_t nbr_ppages)
+{
+  Ppage *to_return = _ppages_alloc_exact(nbr_ppages);
+
+  if (to_return == NULL)
+    panic("Failed to allocate %u physical pages in %s\n", nbr_ppages, __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+/*Same as ppages_alloc_exact() but return NULL if the allocation fails.*/
+Ppage *_ppages_alloc_exact(size_t nbr_ppages)
+{
+  KASSERT(nbr_ppages > 0);
+  
+  uint32_t order = _ppages_order_of(nbr_ppages);
+  Ppage *block = _ppage_block_alloc(order);
+
+  if (block == NULL || nbr_ppages == (1UL << order))
+    return block;
+
+  ppn_t first_ppage = ppage_to_ppn(block);
+
+  ppn_t ppn = first_ppage;
+  
+  for (uint32_t piece_order = order; piece_order > 0; piece_order--)
+    {
+      if (nbr_ppages & (1UL << (piece_order - 1)))
+	{
+	  Ppage *piece = ppn_to_ppage(ppn);
+	  _ppage_set_block_head(piece, piece_order - 1);
+	  _ppage_set_used(piece);
+	  ppn += (1UL << (piece_order - 1));
+	}
+    }
+
+  //The unused tail of the block is released
+  _range_ppages_release(first_ppage + nbr_ppages, first_ppage + (1UL << order) - 1);
+
+  return block;
+}
+
+/**
+ * \fn void ppages_free_exact(ppn_t ppn, size_t nbr_ppages)
+ * \brief Free pages allocated with ppages_alloc_exact().
+ * \param ppn The number of the first page.
+ * \param nbr_ppages The number of pages given to ppages_alloc_exact().
+ */
+void ppages_free_exact(ppn_t ppn, size_t nbr_ppages)
+{
+  KASSERT(nbr_ppages > 0);
+  KASSERT(is_buddy_block(ppn, _ppages_order_of(nbr_ppages)));
+
+  //The pages are freed with the same decomposition as in ppages_alloc_exact()
+  for (uint32_t piece_order = _ppages_order_of(nbr_ppages) + 1; piece_order > 0; piece_order--)
+    {
+      if (nbr_ppages & (1UL << (piece_order - 1)))
+	{
+	  ppage_block_free(ppn, piece_order - 1);
+	  ppn += (1UL << (piece_order - 1));
+	}
+    }
+}
+
+/**
+ * \fn uint32_t ppages_alloc_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+ * \brief Allocate many independent single physical pages at once.
+ * \param ppns Array where the numbers of the allocated pages are stored.
+ * \param nbr_ppages The number of pages to allocate.
+ * \return The number of pages allocated, less than nbr_ppages only if the
+ *         memory is exhausted.
+ *
+ * The biggest possible blocks are taken from the buddy allocator and split
+ * locally, so the free lists are walked once per block instead of once per
+ * page. The higher orders are tried without reclaim: the caches are only
+ * shrunk when the zones can't even give single pages.
+ * The pages can be released one by one or with ppages_free_bulk().
+ */
+uint32_t ppages_alloc_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+{
+  uint32_t nbr_allocated = 0;
+  uint32_t order = MAX_PPAGE_BLOCK_ORDER - 1;
+
+  KASSERT(ppns != NULL);
+
+  while (nbr_allocated < nbr_ppages)
+    {
+      order = MIN(order, most_significant_bit_index(nbr_ppages - nbr_allocated));
+
+      Ppage *block = NULL;
+
+      //The shrinkers are only run when not even a single page is left
+      if (order > 0)
+	block = _zones_block_alloc(order, PPAGE_MIGRATE_UNMOVABLE, PPAGES_WATERMARK_LOW);
+      else
+	block = _buddy_block_alloc(0, PPAGE_MIGRATE_UNMOVABLE);
+
+      if (block == NULL)
+	{
+	  if (order == 0)
+	    break;
+
+	  //No block of this order left, smaller ones are tried
+	  order--;
+	  continue;
+	}
+
+      for (uint32_t i = 0; i < (1UL << order); i++)
+	{
+	  _ppage_set_block_head(block + i, 0);
+	  _ppage_set_used(block + i);
+	  ppns[nbr_allocated++] = ppage_to_ppn(block + i);
+	}
+    }
+
+  return nbr_allocated;
+}
+
+/**
+ * \fn void ppages_free_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+ * \brief Free many single physical pages at once.
+ * \param ppns Array of the numbers of the pages to free, it is sorted.
+ * \param nbr_ppages The number of pages to free.
+ *
+ * The pages are sorted, then each run of contiguous pages is given back to
+ * the buddy allocator as aligned blocks: the buddies are merged once per
+ * block instead of once per page.
+ */
+void ppages_free_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+{
+  KASSERT(ppns != NULL);
+
+  _ppns_sort(ppns, nbr_ppages);
+
+  for (uint32_t first = 0; first < nbr_ppages;)
+    {
+      Physical_memory_zone *zone = ppn_to_zone(ppns[first]);
+      uint32_t last = first;
+
+      KASSERT(zone != NULL);
+
+      for (uint32_t i = first; i < nbr_ppages && (i == first || ppns[i] == ppns[i - 1] + 1) && ppns[i] <= zone->last_ppn; i++)
+	{
+	  Ppage *ppage = ppn_to_ppage(ppns[i]);
+
+	  KASSERT(ppage_is_block_head(ppage) == TRUE);
+	  KASSERT(ppage_block_order(ppage) == 0);
+	  KASSERT(ppage_count(ppage) == 1);
+	  KASSERT(ppage->mapping == (vaddr_t)NULL);
+
+	  //Only the first page of a released range may be a block head
+	  if (i != first)
+	    _ppage_clear_block_head(ppage);
+
+	  last = i;
+	}
+
+      _range_ppages_release(ppns[first], ppns[last]);
+      first = last + 1;
+    }
+}
+
+/**
+ * \fn void ppages_release_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+ * \brief Free used physical pages whatever the allocation they come from.
+ * \param ppns Array of the numbers of the pages to free, it is sorted.
+ * \param nbr_ppages The number of pages to free.
+ *
+ * Used to release the frames found in a virtual mapping: a page may be a
+ * single page, a part of a block or of an exact allocation, or belong to a
+ * slab. Each page is reset as an independent used page, then the merging of
+ * the buddies rebuilds the blocks once all their pages are released.
+ * The caller must release whole allocations: a block whose other pages are
+ * still used elsewhere would be freed twice. The pages must not be shared.
+ */
+void ppages_release_bulk(ppn_t *ppns, uint32_t nbr_ppages)
+{
+  KASSERT(ppns != NULL);
+
+  for (uint32_t i = 0; i < nbr_ppages; i++)
+    {
+      Ppage *ppage = ppn_to_ppage(ppns[i]);
+
+      KASSERT(ppage != NULL);
+      KASSERT(!ppage_is_free(ppage));
+      KASSERT(ppage_count(ppage) <= 1);
+
+      _ppage_set_block_head(ppage, 0);
+      _ppage_set_used(ppage);
+    }
+
+  ppages_free_bulk(ppns, nbr_ppages);
+}
+
+ppn_t ppages_alloc_range(size_t nbr_ppages, paddr_t max_paddr, size_t align, size_t boundary)
+{
+  Ppage *to_return = _ppages_alloc_range(nbr_ppages, max_paddr, align, boundary);
+
+  if (to_return == NULL)
+    panic("Failed to allocate a range of %u physical pages in %s\n", nbr_ppages, __func__);
+
+  return ppage_to_ppn(to_return);
+}
+
+/**
+ * \fn Ppage *_ppages_alloc_range(size_t nbr_ppages, paddr_t max_paddr, size_t align, size_t boundary)
+ * \brief Allocate contiguous physical pages with address constraints, e.g. for
+ *        DMA buffers.
+ * \param nbr_ppages The number of pages to allocate.
+ * \param max_paddr The highest physical address the pages may reach
+ *        (e.g. PPAGES_DMA_LIMIT - 1 for ISA DMA).
+ * \param align Alignment of the first page in bytes, a power of 2 (0 for a page).
+ * \param boundary The pages must not cross a multiple of boundary bytes,
+ *        a power of 2 (0 for no boundary).
+ * \return The descriptor of the first page, NULL if no range fits.
+ *
+ * Unlike the buddy blocks, the range is not a power of 2 of naturally
+ * aligned pages: it is carved out of the free blocks, the zones of the
+ * higher addresses first. The reserved part of the DMA zone may be used.
+ * The pages must be released with ppages_free_range().
+ */
+Ppage *_ppages_alloc_range(size_t nbr_ppages, paddr_t max_paddr, size_t align, size_t boundary)
+{
+  ppn_t max_ppn = paddr_to_ppn(max_paddr);
+  ppn_t align_ppages = (align > PPAGE_SIZE) ? align / PPAGE_SIZE : 1;
+  ppn_t boundary_ppages = boundary / PPAGE_SIZE;
+
+  KASSERT(nbr_ppages > 0);
+  KASSERT((align & (align - 1)) == 0);
+  KASSERT((boundary & (boundary - 1)) == 0);
+
+  if (boundary != 0 && (boundary < PPAGE_SIZE || nbr_ppages > boundary_ppages))
+    return NULL;
+
+  //The last page must be entirely below max_paddr
+  if ((max_paddr & PPAGE_MASK) != PPAGE_MASK)
+    {
+      if (max_ppn == 0)
+	return NULL;
+      max_ppn--;
+    }
+
+  for (uint32_t retry = 0; retry <= PPAGES_RECLAIM_RETRIES; retry++)
+    {
+      for (uint32_t i = memory_zones_count; i > 0; i--)
+	{
+	  Physical_memory_zone *zone = &memory_zones[i - 1];
+	  ppn_t first_ppage;
+
+	  if (zone->first_ppn > max_ppn)
+	    continue;
+
+	  if (_zone_range_find(zone, nbr_ppages, max_ppn, align_ppages, boundary_ppages, &first_ppage) == TRUE)
+	    {
+	      _zone_range_carve(zone, first_ppage, first_ppage + nbr_ppages - 1);
+	      return ppn_to_ppage(first_ppage);
+	    }
+	}
+
+      if (retry == PPAGES_RECLAIM_RETRIES || _ppages_reclaim(nbr_ppages) == 0)
+	break;
+    }
+
+#ifdef DEBUG
+  kprintf("%s: no range of %u page(s) below %p\n", __func__, nbr_ppages, max_paddr);
+#endif
+
+  return NULL;
+}
+
+/**
+ * \fn void ppages_free_range(ppn_t ppn, size_t nbr_ppages)
+ * \brief Free pages allocated with ppages_alloc_range().
+ * \param ppn The number of the first page.
+ * \param nbr_ppages The number of pages given to ppages_alloc_range().
+ */
+void ppages_free_range(ppn_t ppn, size_t nbr_ppages)
+{
+  Ppage *first_ppage = ppn_to_ppage(ppn);
+
+  KASSERT(nbr_ppages > 0);
+  KASSERT(ppage_is_block_head(first_ppage) == TRUE);
+  KASSERT(ppage_count(first_ppage) == 1);
+  KASSERT(first_ppage->mapping == (vaddr_t)NULL);
+
+  _range_ppages_release(ppn, ppn + nbr_ppages - 1);
+}
+
+void ppages_set_slab(ppn_t ppn, uint32_t nbr_pages, const Slab *slab)
+{
+  KASSERT(ppn <= last_ppn);
+  KASSERT(ppn + nbr_pages - 1 <= last_ppn);
+  KASSERT(slab != NULL);
+  KASSERT(slab->vregion != NULL);
+  KASSERT(slab->vregion->nbr_pages == nbr_pages);
+
+  for(uint32_t i = 1; i <= nbr_pages; i++)
+    {
+      _ppage_set_slab(ppn_to_ppage(ppn), slab);
+      ppn++;
+    }
+}
+
+
+
+/* Number of free blocks in a free list.*/
+static uint32_t _free_list_length(Ppage *list)
+{
+  uint32_t length = 0;
+  Ppage *current = list;
+
+  if (clist_is_empty(list))
+    return 0;
+
+  do
+    {
+      length++;
+      current = current->next;
+    }
+  while (current != list);
+
+  return length;
+}
+
+/**
+ * \fn void DEBUG_dump_physical_pages(void)
+ * \brief Print the state of the zones and their fragmentation.
+ *
+ * For an order, the unusable free space is the part of the free pages which
+ * are in blocks too small to serve an allocation of this order.
+ */
+void DEBUG_dump_physical_pages(void)
+{
+  kprintf("%s()\n", __func__);
+
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      const Physical_memory_zone *zone = &memory_zones[i];
+      uint32_t free_ppages_above[MAX_PPAGE_BLOCK_ORDER + 1];
+
+      kprintf("  Zone %u : [%u , %u] - free %u, used %u, deferred %u, reserved %u\n",
+	      i, zone->first_ppn, zone->last_ppn, zone->free_pages_count, zone->used_pages_count,
+	      zone->last_ppn + 1 - zone->deferred_first_ppn, zone->reserved_ppages);
+      kprintf("    watermarks : min %u, low %u, high %u\n",
+	      zone->watermarks[PPAGES_WATERMARK_MIN],
+	      zone->watermarks[PPAGES_WATERMARK_LOW],
+	      zone->watermarks[PPAGES_WATERMARK_HIGH]);
+
+      free_ppages_above[MAX_PPAGE_BLOCK_ORDER] = 0;
+
+      for (uint32_t order = MAX_PPAGE_BLOCK_ORDER; order > 0; order--)
+	{
+	  uint32_t nbr_blocks[PPAGE_MIGRATE_TYPES];
+
+	  for (uint32_t type = 0; type < PPAGE_MIGRATE_TYPES; type++)
+	    nbr_blocks[type] = _free_list_length(zone->free_ppages_blocks_clists[type][order - 1]);
+
+	  free_ppages_above[order - 1] = free_ppages_above[order] +
+	    (nbr_blocks[PPAGE_MIGRATE_UNMOVABLE] + nbr_blocks[PPAGE_MIGRATE_RECLAIMABLE] + nbr_blocks[PPAGE_MIGRATE_MOVABLE]) * (1UL << (order - 1));
+
+	  kprintf("    order %u : %u unmovable, %u reclaimable, %u movable block(s)\n", order - 1,
+		  nbr_blocks[PPAGE_MIGRATE_UNMOVABLE],
+		  nbr_blocks[PPAGE_MIGRATE_RECLAIMABLE],
+		  nbr_blocks[PPAGE_MIGRATE_MOVABLE]);
+	}
+
+      if (zone->free_pages_count > 0)
+	{
+	  kprintf("    unusable free space : order 3 %u%%, order %u %u%%\n",
+		  (zone->free_pages_count - free_ppages_above[3]) * 100 / zone->free_pages_count,
+		  PPAGEBLOCK_ORDER,
+		  (zone->free_pages_count - free_ppages_above[PPAGEBLOCK_ORDER]) * 100 / zone->free_pages_count);
+	}
+    }
+
+  kprintf("  zeroed pages : %u\n", zeroed_ppages_count);
+
+  for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    kprintf("  CPU %u cache : %u page(s)\n", cpu, ppages_cpu_caches[cpu].count);
+}
+
+/**
+ * \fn bool_t DEBUG_check_physical_pages(void)
+ * \brief Check the consistency of the free lists of the zones.
+ * \return TRUE if the lists are consistent, FALSE otherwise.
+ *
+ * Every block of a free list must be a free block head of the order of the
+ * list, inside its zone, in a pageblock of the type of the list, and the
+ * free pages counter and the bitmaps must match the lists.
+ */
+bool_t DEBUG_check_physical_pages(void)
+{
+  bool_t ok = TRUE;
+
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      const Physical_memory_zone *zone = &memory_zones[i];
+      uint32_t nbr_free_ppages = 0;
+
+      for (uint32_t type = 0; type < PPAGE_MIGRATE_TYPES; type++)
+	{
+	  for (uint32_t order = 0; order < MAX_PPAGE_BLOCK_ORDER; order++)
+	    {
+	      Ppage *list = zone->free_ppages_blocks_clists[type][order];
+	      Ppage *current = list;
+	      bool_t bit_set = (zone->free_orders_bitmap[type] & (1UL << order)) ? TRUE : FALSE;
+
+	      if (bit_set != (clist_is_empty(list) ? FALSE : TRUE))
+		{
+		  kprintf("%s: zone %u, bitmap of type %u wrong for order %u\n", __func__, i, type, order);
+		  ok = FALSE;
+		}
+
+	      if (clist_is_empty(list))
+		continue;
+
+	      do
+		{
+		  ppn_t ppn = ppage_to_ppn(current);
+
+		  if (!ppage_is_free(current) || ppage_is_block_head(current) == FALSE ||
+		      ppage_block_order(current) != order || !is_buddy_block(ppn, order) ||
+		      ppn < zone->first_ppn || ppn + (1UL << order) - 1 >= zone->deferred_first_ppn ||
+		      _zone_pageblock_type(zone, ppn) != type)
+		    {
+		      kprintf("%s: zone %u, bad block %u in list [%u][%u]\n", __func__, i, ppn, type, order);
+		      ok = FALSE;
+		    }
+
+		  nbr_free_ppages += (1UL << order);
+		  current = current->next;
+		}
+	      while (current != list);
+	    }
+	}
+
+      if (nbr_free_ppages != zone->free_pages_count)
+	{
+	  kprintf("%s: zone %u, %u free page(s) in the lists, %u counted\n", __func__, i, nbr_free_ppages, zone->free_pages_count);
+	  ok = FALSE;
+	}
+    }
+
+  return ok;
+}
+
+/**
+ * \fn uint32_t DEBUG_unusable_free_space(uint32_t order)
+ * \brief Measure the fragmentation of the free memory for an order.
+ * \return The percentage of the free pages of all the zones which are in
+ *         blocks too small to serve an allocation of this order.
+ */
+uint32_t DEBUG_unusable_free_space(uint32_t order)
+{
+  uint32_t nbr_free_ppages = 0;
+  uint32_t nbr_usable_ppages = 0;
+
+  KASSERT(order < MAX_PPAGE_BLOCK_ORDER);
+
+  for (uint32_t i = 0; i < memory_zones_count; i++)
+    {
+      const Physical_memory_zone *zone = &memory_zones[i];
+
+      nbr_free_ppages += zone->free_pages_count;
+
+      for (uint32_t block_order = order; block_order < MAX_PPAGE_BLOCK_ORDER; block_order++)
+	for (uint32_t type = 0; type < PPAGE_MIGRATE_TYPES; type++)
+	  nbr_usable_ppages += _free_list_length(zone->free_ppages_blocks_clists[type][block_order]) * (1UL << block_order);
+    }
+
+  if (nbr_free_ppages == 0)
+    return 0;
+
+  return (nbr_free_ppages - nbr_usable_ppages) * 100 / nbr_free_ppages;
+}
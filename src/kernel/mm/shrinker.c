@@ -0,0 +1,66 @@
+/**
+ * \file kernel/mm/shrinker.c
+ * \brief Registration of the callbacks run by the physical memory allocator
+ *        to get pages back when the memory is low.
+ */
+#include <types.h>
+
+#include <kernel/list.h>
+#include <kernel/panic.h>
+
+#include <kernel/mm/shrinker.h>
+
+static Shrinker *shrinkers_clist = NULL;
+
+/**
+ * \fn void shrinker_register(Shrinker *shrinker)
+ * \brief Add a shrinker to the list of the shrinkers run by the allocator.
+ * \param shrinker The shrinker to add, it must stay valid until unregistered.
+ */
+void shrinker_register(Shrinker *shrinker)
+{
+  KASSERT(shrinker != NULL);
+  KASSERT(shrinker->shrink != NULL);
+
+  clist_push_tail(shrinkers_clist, shrinker);
+}
+
+/**
+ * \fn void shrinker_unregister(Shrinker *shrinker)
+ * \brief Remove a registered shrinker from the list of the shrinkers.
+ * \param shrinker The shrinker to remove.
+ */
+void shrinker_unregister(Shrinker *shrinker)
+{
+  KASSERT(shrinker != NULL);
+
+  clist_delete_el(shrinkers_clist, shrinker);
+}
+
+/**
+ * \fn uint32_t shrinkers_run(uint32_t nbr_ppages)
+ * \brief Ask the shrinkers, in their order of registration, to free pages.
+ * \param nbr_ppages The number of pages needed.
+ * \return The number of pages freed, it may be more or less than nbr_ppages.
+ *
+ * The shrinkers are run until nbr_ppages pages are freed.
+ */
+uint32_t shrinkers_run(uint32_t nbr_ppages)
+{
+  uint32_t nbr_freed = 0;
+  Shrinker *shrinker = shrinkers_clist;
+
+  if (clist_is_empty(shrinkers_clist))
+    return 0;
+
+  do
+    {
+      uint32_t freed = shrinker->shrink(nbr_ppages - nbr_freed);
+
+      nbr_freed += freed;
+      shrinker = shrinker->next;
+    }
+  while (shrinker != shrinkers_clist && nbr_freed < nbr_ppages);
+
+  return nbr_freed;
+}
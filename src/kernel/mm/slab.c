@@ -9,16 +9,28 @@
 #include <kernel/mm/slab.h>
 #include <kernel/mm/virtual_pages.h>
 #include <kernel/mm/physical_pages.h>
+#include <kernel/mm/shrinker.h>
 
 #include <x86/paging.h>
+#include <x86/x86.h>
+#include <x86/cpucheck.h>
 
 static Objs_cache *caches_clist = NULL;
 
 static Objs_cache *cache_Objs_cache;
-static Objs_cache *cache_Slab;
 
 static Objs_cache *cache_Vregion;
 
+static Objs_cache *cache_Objs_magazine;
+
+static Objs_cache *cache_Objs_cache_cpu;
+
+static uint32_t _objs_caches_shrink(uint32_t nbr_ppages);
+static void *_objs_cache_slab_alloc(Objs_cache *cache);
+static void _objs_cache_slab_free(Objs_cache *cache, void *obj);
+
+static Shrinker objs_caches_shrinker = {"Objects caches", _objs_caches_shrink, NULL, NULL};
+
 static inline uint32_t is_vaddr_in_slab(const Slab *slab, vaddr_t vaddr);
 static inline uint32_t slab_free_objs_count(const Slab *slab);
 static inline int32_t is_slab_full(const Slab *slab);
@@ -26,8 +38,8 @@ static inline int32_t is_slab_empty(const Slab *slab, size_t max_objs);
 static Slab * initialize_slab(Slab *slab,
 			      Vregion *slab_vregion,
 			      size_t actual_obj_size,
+			      size_t colour_offset,
 			      uint32_t nbr_obj_already_used);
-static void _create_slab_for_cache_Slab(void);
 
 static inline uint32_t is_vaddr_in_slab(const Slab *slab, vaddr_t vaddr)
 {
@@ -60,11 +72,14 @@ static inline int32_t is_slab_empty(const Slab *slab, size_t max_objs)
 /**
  * \fn Slab * initialize_slab(Slab *slab,
  *		        Vregion *slab_vregion,
- *		        size_t actual_obj_size)
+ *		        size_t actual_obj_size,
+ *		        size_t colour_offset,
+ *		        uint32_t nbr_obj_already_used)
  * \brief Initialise an existing Slab struct.
  * \param slab Pointer to the Slab structure to initialise.
  * \param slab_vregion The virtual region used by the slab.
  * \param actual_obj_size The size in bytes of an object and its header in the slab.
+ * \param colour_offset Offset in bytes of the first object in the slab (its colour).
  * \param nbr_obj_already_used Indicate the number of objects (all at the beginning of the  * slab) which are already in used and should therefore not be initialized as free.
  * Only for slab allocator initialization purpose.
  * \return Pointer to the given slab.
@@ -72,24 +87,27 @@ static inline int32_t is_slab_empty(const Slab *slab, size_t max_objs)
 static Slab * initialize_slab(Slab *slab,
 			      Vregion *slab_vregion,
 			      size_t actual_obj_size,
+			      size_t colour_offset,
 			      uint32_t nbr_obj_already_used)
 {
   KASSERT(slab != NULL);
   KASSERT(slab_vregion != NULL);
   KASSERT(vpn_to_vaddr(vregion_first_vpn(slab_vregion)) != (vaddr_t)NULL); //NULL is a forbidden address
+  KASSERT(colour_offset < slab_objs_area_size(vregion_size(slab_vregion)));
 
-  slab->free_objs_count = vregion_size(slab_vregion) / actual_obj_size - nbr_obj_already_used;
+  slab->free_objs_count = (slab_objs_area_size(vregion_size(slab_vregion)) - colour_offset) / actual_obj_size - nbr_obj_already_used;
   slab->vregion = slab_vregion;
   slab->free_objs_list = NULL;
+  slab->cache = NULL;
   slab->prev = NULL;
   slab->next = NULL;
 
-  if (vregion_size(slab_vregion) >= actual_obj_size)
+  if (slab_objs_area_size(vregion_size(slab_vregion)) - colour_offset >= actual_obj_size)
     {
       //We set up the list of free objects
 
       vaddr_t slab_vregion_vaddr = vpn_to_vaddr(vregion_first_vpn(slab_vregion));
-      Slab_object *current_obj = (Slab_object*)(slab_vregion_vaddr + nbr_obj_already_used * actual_obj_size);
+      Slab_object *current_obj = (Slab_object*)(slab_vregion_vaddr + colour_offset + nbr_obj_already_used * actual_obj_size);
       Slab_object *next_obj = NULL;
 
       slab->free_objs_list = current_obj;
@@ -116,50 +134,52 @@ static Slab * initialize_slab(Slab *slab,
 
 
 /**
- * \fn Slab * create_slab(Vpages_block *slab_vpages,
- *		          size_t actual_obj_size)
- * \brief Create and initialise a Slab structure.
+ * \fn Slab * create_slab(uint32_t nbr_pages, size_t actual_obj_size, size_t colour_offset)
+ * \brief Create and initialise a slab, its Slab structure is stored at its end.
  * \param nbr_pages The number of virtual pages used by the slab.
  * \param actual_obj_size The size of an object and its header in the slab.
+ * \param colour_offset Offset in bytes of the first object in the slab.
  * \return Pointer to the created slab, NULL if creation failed.
  */
-static Slab * create_slab(uint32_t nbr_pages, size_t actual_obj_size)
+static Slab * create_slab(uint32_t nbr_pages, size_t actual_obj_size, size_t colour_offset)
 {
-  Slab *new_slab = objs_cache_alloc(cache_Slab);
+  /*The physical pages are allocated first: when the memory is low, this is
+    the allocation which fails and nothing has to be undone*/
+  //Single page slabs are spread over the page colours
+  Ppage *slab_ppages = (nbr_pages == 1) ? _ppage_alloc_colour(PPAGE_NEXT_COLOUR) : _ppages_alloc_exact(nbr_pages);
+  Slab *new_slab = NULL;
 
-  if (new_slab != NULL)
+  if (slab_ppages == NULL)
     {
-      Vregion *slab_vregion = vregion_alloc(nbr_pages);
-      
-      if (slab_vregion != NULL)
-	{
-	  ppn_t slab_ppages = ppages_alloc(nbr_pages);
-	  
-	  map_pages(slab_ppages,
-		    vregion_first_vpn(slab_vregion),
-		    nbr_pages,
-		    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
-	  
-	  initialize_slab(new_slab,
-			  slab_vregion,
-			  actual_obj_size,
-			  0);
-	  
-	  ppages_set_slab(slab_ppages, nbr_pages, new_slab);
-	}
-      else
-	{
-	  objs_cache_free(cache_Slab, new_slab);
-	  new_slab = NULL;
 #ifdef DEBUG
-	  kprintf("Failed to allocated a new virtual region for a new slab in %s\n", __func__);
+      kprintf("Failed to allocate the physical pages of a new slab in %s\n", __func__);
 #endif
-	}
+      return NULL;
+    }
+
+  Vregion *slab_vregion = vregion_alloc(nbr_pages);
+      
+  if (slab_vregion != NULL)
+    {
+      map_pages(ppage_to_ppn(slab_ppages),
+		vregion_first_vpn(slab_vregion),
+		nbr_pages,
+		PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+
+      new_slab = slab_header_of(slab_vregion);
+      initialize_slab(new_slab,
+		      slab_vregion,
+		      actual_obj_size,
+		      colour_offset,
+		      0);
+	  
+      ppages_set_slab(ppage_to_ppn(slab_ppages), nbr_pages, new_slab);
     }
   else
     {
+      ppages_free_exact(ppage_to_ppn(slab_ppages), nbr_pages);
 #ifdef DEBUG
-      kprintf("Failed to allocate a new Slab object in %s\n", __func__);
+      kprintf("Failed to allocated a new virtual region for a new slab in %s\n", __func__);
 #endif
     }
 
@@ -229,12 +249,52 @@ static bool_t free_obj_from_slab(Slab *slab, void *obj)
 
 
 
+/* Alignment of the objects of a cache created with the given flags */
+static size_t _objs_align(uint32_t flags)
+{
+  size_t align = sizeof(void*);
+
+  if (flags & OBJS_CACHE_ALIGN_MASK)
+    align = MAX(align, 1UL << ((flags & OBJS_CACHE_ALIGN_MASK) >> OBJS_CACHE_ALIGN_SHIFT));
+
+  if (flags & OBJS_CACHE_HWCACHE_ALIGN)
+    align = MAX(align, (size_t)cpu_cache_line_size());
+
+  KASSERT(align <= VPAGE_SIZE);
+
+  return align;
+}
+
+/* Size of an object padded so that the next object is aligned too */
+static size_t _objs_actual_size(size_t obj_size, uint32_t flags)
+{
+  size_t align = _objs_align(flags);
+  size_t size  = MAX(obj_size, sizeof(void*));
+
+  return ROUNDUP(size, align);
+}
+
+/* Offset of the first object of the next slab of a cache: the successive
+ * slabs start their objects on different cache lines, so that the objects
+ * at the same index of each slab don't all fall in the same cache sets.
+ */
+static size_t _objs_cache_next_colour_offset(Objs_cache *cache)
+{
+  size_t colour_offset = cache->next_colour * cache->colour_step;
+
+  cache->next_colour = (cache->next_colour + 1) % cache->colours_count;
+
+  return colour_offset;
+}
+
 /*Add a slab to a given cache*/
 static void objs_cache_add_slab(Objs_cache *cache, Slab *slab, uint32_t slab_status)
 {
   KASSERT(cache != NULL);
   KASSERT(slab != NULL);
   KASSERT(slab_status != SLAB_STATUS_FREE || cache->objs_per_slab == slab->free_objs_count);
+
+  slab->cache = cache;
   
   switch (slab_status)
     {
@@ -262,6 +322,165 @@ static void objs_cache_add_slab(Objs_cache *cache, Slab *slab, uint32_t slab_sta
 }
 
 
+/* Exchange the loaded and the previous magazines of a CPU */
+static inline void _objs_cache_cpu_swap(Objs_cache_cpu *cpu)
+{
+  Objs_magazine *tmp_magazine = cpu->loaded;
+
+  cpu->loaded   = cpu->previous;
+  cpu->previous = tmp_magazine;
+}
+
+/* Whether a CPU other than the running one holds objects (full is TRUE) or
+ * room for objects (full is FALSE) in its magazines
+ */
+static bool_t _objs_cache_other_cpus_hold(const Objs_cache *cache, bool_t full)
+{
+  uint32_t cpu_id = current_cpu_id();
+
+  for (uint32_t i = 0; i < MAX_CPUS; i++)
+    {
+      if (i == cpu_id)
+	continue;
+
+      const Objs_magazine *magazines[2] = {cache->cpus[i]->loaded, cache->cpus[i]->previous};
+
+      for (uint32_t j = 0; j < 2; j++)
+	{
+	  if (magazines[j] == NULL)
+	    continue;
+
+	  if (full ? magazines[j]->rounds > 0 : magazines[j]->rounds < magazines[j]->size)
+	    return TRUE;
+	}
+    }
+
+  return FALSE;
+}
+
+/* The depot couldn't provide a full magazine (full is TRUE) or an empty one.
+ * A miss only tells something when another CPU holds what was missing: the
+ * objects bounce between the CPUs through the depot, bigger magazines make
+ * them go there less often. Cold misses (nothing is cached anywhere yet)
+ * aren't counted, the magazines would always grow to the maximum.
+ * After OBJS_MAGAZINE_RESIZE_MISSES counted misses, the new magazines of the
+ * cache are made bigger.
+ */
+static void _objs_cache_depot_miss(Objs_cache *cache, bool_t full)
+{
+  if (!_objs_cache_other_cpus_hold(cache, full))
+    return;
+
+  cache->depot_misses++;
+
+  if (cache->depot_misses >= OBJS_MAGAZINE_RESIZE_MISSES &&
+      cache->magazine_size < OBJS_MAGAZINE_MAX_ROUNDS)
+    {
+      cache->magazine_size = MIN(2 * cache->magazine_size, (uint32_t)OBJS_MAGAZINE_MAX_ROUNDS);
+      cache->depot_misses = 0;
+    }
+}
+
+/* Allocate the magazines of each CPU, on their own cache lines. Return FALSE
+ * if the memory is exhausted, the cache then works without magazines.
+ */
+static bool_t _objs_cache_cpus_alloc(Objs_cache *cache)
+{
+  KASSERT(cache_Objs_cache_cpu != NULL);
+
+  for (uint32_t i = 0; i < MAX_CPUS; i++)
+    {
+      cache->cpus[i] = objs_cache_alloc(cache_Objs_cache_cpu);
+
+      if (cache->cpus[i] == NULL)
+	{
+	  while (i-- > 0)
+	    {
+	      objs_cache_free(cache_Objs_cache_cpu, cache->cpus[i]);
+	      cache->cpus[i] = NULL;
+	    }
+
+	  return FALSE;
+	}
+
+      cache->cpus[i]->loaded   = NULL;
+      cache->cpus[i]->previous = NULL;
+    }
+
+  return TRUE;
+}
+
+/* Allocate an empty magazine of the current size of the cache */
+static Objs_magazine *_objs_magazine_create(Objs_cache *cache)
+{
+  Objs_magazine *magazine = objs_cache_alloc(cache_Objs_magazine);
+
+  if (magazine != NULL)
+    {
+      magazine->rounds = 0;
+      magazine->size   = cache->magazine_size;
+      magazine->next   = NULL;
+    }
+
+  return magazine;
+}
+
+/* Give back the objects of a magazine to their slabs and free the magazine,
+ * return the number of objects given back */
+static uint32_t _objs_magazine_destroy(Objs_cache *cache, Objs_magazine *magazine)
+{
+  uint32_t rounds = magazine->rounds;
+
+  while (magazine->rounds > 0)
+    _objs_cache_slab_free(cache, magazine->objs[--magazine->rounds]);
+
+  objs_cache_free(cache_Objs_magazine, magazine);
+
+  return rounds;
+}
+
+/* Shrinker of the objects caches: the magazines are drained, then the free
+ * slabs are destroyed. The reserve of Vregion objects of the virtual pages
+ * allocator is kept.
+ */
+static uint32_t _objs_caches_shrink(uint32_t nbr_ppages)
+{
+  uint32_t freed = 0;
+  Objs_cache *cache = caches_clist;
+
+  if (clist_is_empty(caches_clist))
+    return 0;
+
+  do
+    {
+      //The objects held by the magazines may be all that keeps a slab used
+      objs_cache_drain(cache);
+
+      while (!dlist_is_empty(cache->free_slabs) && freed < nbr_ppages &&
+	     (cache != cache_Vregion ||
+	      cache->free_objs_count >= MIN_FREE_OBJS_CACHE_VREGION + cache->objs_per_slab))
+	{
+	  Slab *slab = cache->free_slabs;
+	  Vregion *slab_vregion = slab->vregion;
+
+	  dlist_delete_head(cache->free_slabs, slab);
+	  cache->free_slabs_count--;
+	  cache->slabs_count--;
+	  cache->free_objs_count -= cache->objs_per_slab;
+
+	  //The Slab structure is in the slab: it is released with the pages
+	  vregion_free(slab_vregion);
+	  freed += cache->pages_per_slab;
+	}
+
+      cache = cache->next;
+    }
+  while (cache != caches_clist && freed < nbr_ppages);
+
+  return freed;
+}
+
+
 /**********************************************************
                    Public functions
 **********************************************************/
@@ -273,87 +492,95 @@ void objs_cache_boot_init(void)
    * and the slab allocator relies on the virtual pages allocator (to create new slabs), we have
    * to initialize simultaneously both allocators.
    *
+   * The Slab structures are stored at the end of their slabs, so only 2 caches are needed :
+   *     - the cache Objs_cache  > used by the slab allocator system
+   *	 - the cache Vregion_cache > used by the virtual pages allocator
+   *
    * This is done in 4 steps :
    * 1) allocate the virtual pages (using the boot virtual pages allocator) 
-   *    of the first slabs for each of the following objects caches :
-   *     - the cache Objs_cache						\
-   *	                        > both used by the slab allocator system
-   *	- the cache Slab_cache /
-   *	- the cache Vregion_cache > used by the virtual pages allocator
-   * 2) allocate the physical pages used by the 3 slabs
+   *    of the first slabs of both caches
+   * 2) allocate the physical pages used by the 2 slabs
    * 3) map the virtual pages to the physical pages
-   * 4) initialize in each slabs the required objects which described the 3 caches, their 
+   * 4) initialize in each slabs the required objects which described the 2 caches, their 
    *    slabs and the virtual pages (Vregion) allocated in phase 2.
    */
   
   //Step 1:
   vpn_t cache_Objs_cache_slab_vpn = _boot_virtual_pages_alloc(VPAGES_PER_SLAB_CACHE_OBJS_CACHE);
-  vpn_t cache_Slab_slab_vpn       = _boot_virtual_pages_alloc(VPAGES_PER_SLAB_CACHE_SLAB);
   vpn_t cache_Vregion_slab_vpn    = _boot_virtual_pages_alloc(VPAGES_PER_SLAB_CACHE_VREGION);
 
   //Steps 2
-  ppn_t ppages_for_Objs_cache_slab = ppages_alloc(VPAGES_PER_SLAB_CACHE_OBJS_CACHE);
-  ppn_t ppages_for_Slab_slab       = ppages_alloc(VPAGES_PER_SLAB_CACHE_SLAB);
-  ppn_t ppages_for_Vregion_slab    = ppages_alloc(VPAGES_PER_SLAB_CACHE_VREGION);
+  ppn_t ppages_for_Objs_cache_slab = ppages_alloc_exact(VPAGES_PER_SLAB_CACHE_OBJS_CACHE);
+  ppn_t ppages_for_Vregion_slab    = ppages_alloc_exact(VPAGES_PER_SLAB_CACHE_VREGION);
   
   //Steps 3
   map_pages(ppages_for_Objs_cache_slab,
 	    cache_Objs_cache_slab_vpn,
 	    VPAGES_PER_SLAB_CACHE_OBJS_CACHE,
 	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
-  map_pages(ppages_for_Slab_slab,
-	    cache_Slab_slab_vpn,
-	    VPAGES_PER_SLAB_CACHE_SLAB,
-	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
   map_pages(ppages_for_Vregion_slab,
 	    cache_Vregion_slab_vpn,
 	    VPAGES_PER_SLAB_CACHE_VREGION,
 	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
 
   Objs_cache *a_Objs_cache = (Objs_cache*)vpn_to_vaddr(cache_Objs_cache_slab_vpn);
-  Slab *a_Slab             = (Slab*)vpn_to_vaddr(cache_Slab_slab_vpn);
   Vregion *a_Vregion       = (Vregion*)vpn_to_vaddr(cache_Vregion_slab_vpn);
 
   //Step 4
   
-  //We initialize the 3 Vregion objects which describe the allocated virtual regions for each slabs
+  //We initialize the 2 Vregion objects which describe the allocated virtual regions for each slabs
   vregion_init(a_Vregion, cache_Objs_cache_slab_vpn, VPAGES_PER_SLAB_CACHE_OBJS_CACHE);
-  vregion_init(a_Vregion + 1, cache_Slab_slab_vpn, VPAGES_PER_SLAB_CACHE_SLAB);
-  vregion_init(a_Vregion + 2, cache_Vregion_slab_vpn, VPAGES_PER_SLAB_CACHE_VREGION);
+  vregion_init(a_Vregion + 1, cache_Vregion_slab_vpn, VPAGES_PER_SLAB_CACHE_VREGION);
 
-  a_Vregion->next = (a_Vregion + 1);
-  (a_Vregion + 1)->next = (a_Vregion + 2);
-  (a_Vregion + 2)->next = NULL;
-  
-  //We initialize the 3 Slab objects.
-  initialize_slab(a_Slab, a_Vregion, MAX(sizeof(Objs_cache), sizeof(void*)), 3);
-  initialize_slab(a_Slab + 1, a_Vregion + 1, MAX(sizeof(Slab), sizeof(void*)), 3);
-  initialize_slab(a_Slab + 2, a_Vregion + 2, MAX(sizeof(Vregion), sizeof(void*)), 3);
+  Slab *a_Objs_cache_slab = slab_header_of(a_Vregion);
+  Slab *a_Vregion_slab    = slab_header_of(a_Vregion + 1);
 
-  //We link the physical pages allocated to the appropriate slab
-  ppages_set_slab(ppages_for_Objs_cache_slab, VPAGES_PER_SLAB_CACHE_OBJS_CACHE, a_Slab);
-  ppages_set_slab(ppages_for_Slab_slab, VPAGES_PER_SLAB_CACHE_SLAB, a_Slab + 1);
-  ppages_set_slab(ppages_for_Vregion_slab, VPAGES_PER_SLAB_CACHE_VREGION, a_Slab + 2);
-		  
-  //We initialize the 3 Objs_cache objects
-  objs_cache_init(a_Objs_cache, "Objs_cache", sizeof(Objs_cache), VPAGES_PER_SLAB_CACHE_OBJS_CACHE);
-  objs_cache_init(a_Objs_cache + 1, "Slab", sizeof(Slab),  VPAGES_PER_SLAB_CACHE_SLAB);
-  objs_cache_init(a_Objs_cache + 2, "Vregion", sizeof(Vregion), VPAGES_PER_SLAB_CACHE_VREGION);
-
-  //We initialiaze the pointers to the 3 caches
+  //We initialize the 2 Objs_cache objects, the allocators' own objects bypass the magazines
+  objs_cache_init(a_Objs_cache, "Objs_cache", sizeof(Objs_cache), VPAGES_PER_SLAB_CACHE_OBJS_CACHE, OBJS_CACHE_NO_MAGAZINES);
+  objs_cache_init(a_Objs_cache + 1, "Vregion", sizeof(Vregion), VPAGES_PER_SLAB_CACHE_VREGION, OBJS_CACHE_NO_MAGAZINES);
+
+  //We initialiaze the pointers to the 2 caches
   cache_Objs_cache = a_Objs_cache;
-  cache_Slab       = a_Objs_cache + 1;
-  cache_Vregion    = a_Objs_cache + 2;
+  cache_Vregion    = a_Objs_cache + 1;
+
+  //The objects already used are accessed as arrays
+  KASSERT(cache_Objs_cache->actual_obj_size == sizeof(Objs_cache));
+  KASSERT(cache_Vregion->actual_obj_size == sizeof(Vregion));
+
+  //We initialize the 2 Slab structures, at the end of their slabs
+  initialize_slab(a_Objs_cache_slab, a_Vregion, cache_Objs_cache->actual_obj_size, 0, 2);
+  initialize_slab(a_Vregion_slab, a_Vregion + 1, cache_Vregion->actual_obj_size, 0, 2);
+
+  //We link the physical pages allocated to the appropriate slab
+  ppages_set_slab(ppages_for_Objs_cache_slab, VPAGES_PER_SLAB_CACHE_OBJS_CACHE, a_Objs_cache_slab);
+  ppages_set_slab(ppages_for_Vregion_slab, VPAGES_PER_SLAB_CACHE_VREGION, a_Vregion_slab);
 
   //We add each slab created to the appropriate cache
-  objs_cache_add_slab(cache_Objs_cache, a_Slab, SLAB_STATUS_PARTIAL);
-  objs_cache_add_slab(cache_Slab, a_Slab + 1, SLAB_STATUS_PARTIAL);
-  objs_cache_add_slab(cache_Vregion, a_Slab + 2, SLAB_STATUS_PARTIAL);
+  objs_cache_add_slab(cache_Objs_cache, a_Objs_cache_slab, SLAB_STATUS_PARTIAL);
+  objs_cache_add_slab(cache_Vregion, a_Vregion_slab, SLAB_STATUS_PARTIAL);
 
-  KASSERT(cache_Slab->free_objs_count > MIN_FREE_OBJS_CACHE_SLAB);
-    
   //We initialize the virtual pages allocator
-  virtual_page_boot_init(cache_Vregion, a_Vregion);
+  virtual_page_boot_init(cache_Vregion, a_Vregion, 2);
+
+  //The magazines can't come from magazines, each one is used by a single CPU at a time
+  cache_Objs_magazine = objs_cache_create("Objs_magazine",
+					  sizeof(Objs_magazine),
+					  1,
+					  OBJS_CACHE_NO_MAGAZINES | OBJS_CACHE_HWCACHE_ALIGN);
+
+  if (cache_Objs_magazine == NULL)
+    panic("Failed to create the cache of the magazines in %s()\n", __func__);
+
+  //Aligned so that two CPUs never write to the same cache line
+  cache_Objs_cache_cpu = objs_cache_create("Objs_cache_cpu",
+					   sizeof(Objs_cache_cpu),
+					   1,
+					   OBJS_CACHE_NO_MAGAZINES | OBJS_CACHE_HWCACHE_ALIGN);
+
+  if (cache_Objs_cache_cpu == NULL)
+    panic("Failed to create the cache of the per CPU magazines in %s()\n", __func__);
+
+  shrinker_register(&objs_caches_shrinker);
 }
 
 
@@ -361,23 +588,26 @@ void objs_cache_boot_init(void)
  * \fn Objs_cache * objs_cache_init(Objs_cache *cache,
  *			            const char *name,
  *			            size_t obj_size,
- *			            uint32_t pages_per_slab)
+ *			            uint32_t pages_per_slab,
+ *			            uint32_t flags)
  * \brief Initialise a given Objs_cache structure.
  * \param cache The cache to initialise.
  * \param name The name of the cache.
  * \param obj_size The size in bytes of an object in the cache.
  * \param pages_per_slab Number of virtual pages occupied by a slab.
+ * \param flags OBJS_CACHE_* flags, OBJS_CACHE_ALIGN() gives an explicit alignment.
  * \return Pointer to cache.
  */
 Objs_cache * objs_cache_init(Objs_cache *cache,
 			     const char *name,
 			     size_t obj_size,
-			     uint32_t pages_per_slab)
+			     uint32_t pages_per_slab,
+			     uint32_t flags)
 {
   KASSERT(cache != NULL);
   KASSERT(obj_size > 0);
   KASSERT(pages_per_slab > 0);
-  KASSERT(obj_size <= (pages_per_slab * VPAGE_SIZE));
+  KASSERT(_objs_actual_size(obj_size, flags) <= slab_objs_area_size(pages_per_slab * VPAGE_SIZE));
  
   if (name != NULL)
     {
@@ -390,12 +620,18 @@ Objs_cache * objs_cache_init(Objs_cache *cache,
    }
 
   cache->obj_size        = obj_size;
-  cache->actual_obj_size = MAX(obj_size,sizeof(void*));
+  cache->align           = _objs_align(flags);
+  cache->actual_obj_size = _objs_actual_size(obj_size, flags);
  
   cache->pages_per_slab  = pages_per_slab;
   cache->slab_size       = pages_per_slab * VPAGE_SIZE;
-  cache->objs_per_slab   = pages_per_slab * VPAGE_SIZE / cache->actual_obj_size;
-  cache->wasted_memory_per_slab = cache->slab_size - cache->objs_per_slab * cache->actual_obj_size;
+  cache->objs_per_slab   = slab_objs_area_size(cache->slab_size) / cache->actual_obj_size;
+  cache->wasted_memory_per_slab = slab_objs_area_size(cache->slab_size) - cache->objs_per_slab * cache->actual_obj_size;
+
+  //The wasted bytes are used to shift the objects of the successive slabs, keeping their alignment
+  cache->colour_step   = MAX((size_t)cpu_cache_line_size(), cache->align);
+  cache->colours_count = cache->wasted_memory_per_slab / cache->colour_step + 1;
+  cache->next_colour   = 0;
   
   cache->free_objs_count = 0;
   cache->used_objs_count = 0;
@@ -409,6 +645,21 @@ Objs_cache * objs_cache_init(Objs_cache *cache,
   cache->partial_slabs = NULL;
   cache->full_slabs    = NULL;
   
+  cache->flags = flags;
+
+  for (uint32_t i = 0; i < MAX_CPUS; i++)
+    cache->cpus[i] = NULL;
+
+  if (!(flags & OBJS_CACHE_NO_MAGAZINES) && !_objs_cache_cpus_alloc(cache))
+    cache->flags |= OBJS_CACHE_NO_MAGAZINES;
+
+  cache->magazine_size     = OBJS_MAGAZINE_MIN_ROUNDS;
+  cache->depot_misses      = 0;
+  cache->depot_full        = NULL;
+  cache->depot_empty       = NULL;
+  cache->depot_full_count  = 0;
+  cache->depot_empty_count = 0;
+
   cache->prev     = NULL;
   cache->next     = NULL;
 
@@ -421,22 +672,25 @@ Objs_cache * objs_cache_init(Objs_cache *cache,
 /**
  * \fn Ojs_cache *objs_cache_create(const char *name,
  *			             size_t obj_size,
- *			             uint32_t pages_per_slab)
+ *			             uint32_t pages_per_slab,
+ *			             uint32_t flags)
  * \brief Create and initialise a new Objs_cache structure.
  * \param name Name of the cache to create.
  * \param obj_size Size in byte of an object in the cache.
  * \param pages_per_slab Number of virtual pages occupied by a slab.
- * \param min_free_objs The number of free objects the cache must have at any time.
+ * \param flags OBJS_CACHE_* flags: OBJS_CACHE_HWCACHE_ALIGN to keep each object
+ *        on its own cache lines, OBJS_CACHE_ALIGN(n) for an explicit alignment.
  * \return Pointer to the created cache, NULL if created failed.
  */
 Objs_cache *objs_cache_create(const char *name,
 			       size_t obj_size,
-			       uint32_t pages_per_slab)
+			       uint32_t pages_per_slab,
+			       uint32_t flags)
 {
   Objs_cache *new_cache = NULL;
 
   //Can a slab contain at least one object ?
-  if (MAX(obj_size,sizeof(void*))  <= pages_per_slab * VPAGE_SIZE)
+  if (_objs_actual_size(obj_size, flags) <= slab_objs_area_size(pages_per_slab * VPAGE_SIZE))
     {
       new_cache = objs_cache_alloc(cache_Objs_cache);
 
@@ -445,7 +699,8 @@ Objs_cache *objs_cache_create(const char *name,
 	  objs_cache_init(new_cache,
 			  name,
 			  obj_size,
-			  pages_per_slab);
+			  pages_per_slab,
+			  flags);
 	}
       else
 	{
@@ -459,30 +714,29 @@ Objs_cache *objs_cache_create(const char *name,
 }
 
 
-
-void *objs_cache_alloc(Objs_cache *cache)
+/* Allocate an object from the slabs of a cache, below the magazines.
+ * Return NULL if the physical memory is exhausted.
+ */
+static void *_objs_cache_slab_alloc(Objs_cache *cache)
 {
   void *allocated_obj = NULL;
   KASSERT(cache != NULL);
-  KASSERT(cache_Slab->free_objs_count >= MIN_FREE_OBJS_CACHE_SLAB);
-
 
-  if (cache_Slab->free_objs_count == MIN_FREE_OBJS_CACHE_SLAB)
-    {
-      _create_slab_for_cache_Slab();
-    }
-
-  if (cache_Vregion->free_objs_count == MIN_FREE_OBJS_CACHE_VREGION)
-    {
-      _create_slab_for_cache_Vregion();
-    }
-  
+  //Slow path: the cache is empty, it gets a new slab
   if (cache->free_objs_count == 0)
     {
-      Slab *new_slab = create_slab(cache->pages_per_slab, cache->actual_obj_size);
+      Slab *new_slab = create_slab(cache->pages_per_slab,
+				   cache->actual_obj_size,
+				   _objs_cache_next_colour_offset(cache));
 
+      //The physical memory is exhausted, even after the reclaim
       if (new_slab == NULL)
-	panic("Can't create a new slab for a cache (%s) in %s\n", cache->name, __func__);
+	{
+#ifdef DEBUG
+	  kprintf("Can't create a new slab for a cache (%s) in %s\n", cache->name, __func__);
+#endif
+	  return NULL;
+	}
 
       objs_cache_add_slab(cache, new_slab, SLAB_STATUS_FREE);
     }
@@ -495,12 +749,214 @@ void *objs_cache_alloc(Objs_cache *cache)
   return allocated_obj;
 }
 
+/* Give back an object to its slab, below the magazines. The slab of the
+ * object is found in O(1) through the descriptor of the physical page which
+ * backs the object.
+ */
+static void _objs_cache_slab_free(Objs_cache *cache, void *obj)
+{
+  KASSERT(cache != NULL);
+  KASSERT(obj != NULL);
+
+  paddr_t obj_paddr = virt_to_phys_addr((vaddr_t)obj);
+
+  if (obj_paddr == (paddr_t)NULL)
+    panic("Try to free an object (%p) which isn't mapped in %s()\n", obj, __func__);
+
+  Slab *slab = ppage_slab(paddr_to_ppage(obj_paddr));
+
+  if (slab == NULL || slab->cache != cache || !free_obj_from_slab(slab, obj))
+    panic("The object %p doesn't belong to a slab of cache %s in %s()\n", obj, cache->name, __func__);
+
+  cache->free_objs_count++;
+  cache->used_objs_count--;
+
+  if (slab_free_objs_count(slab) == 1)
+    {
+      //the slab was full
+      dlist_delete_el_generic(cache->full_slabs, slab, prev, next);
+      cache->full_slabs_count--;
+
+      if (is_slab_empty(slab, cache->objs_per_slab))
+	{
+	  //NB : this case only occurs when a slab can contain only one object
+	  dlist_push_head(cache->free_slabs, slab);
+	  cache->free_slabs_count++;
+	}
+      else
+	{
+	  dlist_push_head(cache->partial_slabs, slab);
+	  cache->partial_slabs_count++;
+	}
+    }
+  else if (is_slab_empty(slab, cache->objs_per_slab))
+    {
+      //the slab was partially used
+      dlist_delete_el_generic(cache->partial_slabs, slab, prev, next);
+      dlist_push_head(cache->free_slabs, slab);
+
+      cache->partial_slabs_count--;
+      cache->free_slabs_count++;
+    }
+}
+
+
+/**
+ * \fn void *objs_cache_alloc(Objs_cache *cache)
+ * \brief Allocate an object from a cache.
+ * \param cache The cache from where to allocate an object.
+ * \return Pointer to the allocated object, NULL if the physical memory is
+ *         exhausted (the shrinkers have already been run).
+ *
+ * The object is taken from the magazines of the running CPU when possible,
+ * then from a full magazine of the depot, and only then from the slabs.
+ */
+void *objs_cache_alloc(Objs_cache *cache)
+{
+  KASSERT(cache != NULL);
+
+  if (cache->flags & OBJS_CACHE_NO_MAGAZINES)
+    return _objs_cache_slab_alloc(cache);
+
+  Objs_cache_cpu *cpu = cache->cpus[current_cpu_id()];
+
+  if (cpu->loaded != NULL && cpu->loaded->rounds > 0)
+    return cpu->loaded->objs[--cpu->loaded->rounds];
+
+  if (cpu->previous != NULL && cpu->previous->rounds > 0)
+    {
+      _objs_cache_cpu_swap(cpu);
+      return cpu->loaded->objs[--cpu->loaded->rounds];
+    }
+
+  //Both magazines are empty: a full one is taken from the depot
+  if (!list_is_empty(cache->depot_full))
+    {
+      if (cpu->previous != NULL)
+	{
+	  list_push_head(cache->depot_empty, cpu->previous);
+	  cache->depot_empty_count++;
+	}
+
+      cpu->previous = cpu->loaded;
+      cpu->loaded = list_pop_head(cache->depot_full);
+      cache->depot_full_count--;
+
+      return cpu->loaded->objs[--cpu->loaded->rounds];
+    }
+
+  _objs_cache_depot_miss(cache, TRUE);
+
+  return _objs_cache_slab_alloc(cache);
+}
+
+/**
+ * \fn void objs_cache_free(Objs_cache *cache, void *obj)
+ * \brief Give back an object to its cache.
+ * \param cache The cache from where the object was allocated.
+ * \param obj The object to free.
+ *
+ * The object is put in the magazines of the running CPU when possible, the
+ * full magazines go to the depot. The object only goes back to its slab if
+ * no magazine can be allocated.
+ */
 void objs_cache_free(Objs_cache *cache, void *obj)
 {
   KASSERT(cache != NULL);
   KASSERT(obj != NULL);
 
-  panic("objs_cache_free() not implemented yet!\n");
+  if (cache->flags & OBJS_CACHE_NO_MAGAZINES)
+    {
+      _objs_cache_slab_free(cache, obj);
+      return;
+    }
+
+  Objs_cache_cpu *cpu = cache->cpus[current_cpu_id()];
+
+  if (cpu->loaded != NULL && cpu->loaded->rounds < cpu->loaded->size)
+    {
+      cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+      return;
+    }
+
+  if (cpu->previous != NULL && cpu->previous->rounds == 0)
+    {
+      _objs_cache_cpu_swap(cpu);
+      cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+      return;
+    }
+
+  //Both magazines are full (or missing): an empty one is taken from the depot
+  Objs_magazine *empty_magazine = NULL;
+
+  if (!list_is_empty(cache->depot_empty))
+    {
+      empty_magazine = list_pop_head(cache->depot_empty);
+      cache->depot_empty_count--;
+    }
+  else
+    {
+      _objs_cache_depot_miss(cache, FALSE);
+      empty_magazine = _objs_magazine_create(cache);
+
+      if (empty_magazine == NULL)
+	{
+	  _objs_cache_slab_free(cache, obj);
+	  return;
+	}
+    }
+
+  if (cpu->previous != NULL)
+    {
+      list_push_head(cache->depot_full, cpu->previous);
+      cache->depot_full_count++;
+    }
+
+  cpu->previous = cpu->loaded;
+  cpu->loaded = empty_magazine;
+  cpu->loaded->objs[cpu->loaded->rounds++] = obj;
+}
+
+/**
+ * \fn uint32_t objs_cache_drain(Objs_cache *cache)
+ * \brief Give back to the slabs all the objects held by the magazines of a cache.
+ * \param cache The cache to drain.
+ * \return The number of objects given back to the slabs.
+ *
+ * The magazines of the depot and of all the CPUs are emptied and freed.
+ */
+uint32_t objs_cache_drain(Objs_cache *cache)
+{
+  uint32_t drained = 0;
+
+  KASSERT(cache != NULL);
+
+  for (uint32_t i = 0; i < MAX_CPUS; i++)
+    {
+      Objs_cache_cpu *cpu = cache->cpus[i];
+
+      if (cpu == NULL)
+	continue;
+
+      if (cpu->loaded != NULL)
+	drained += _objs_magazine_destroy(cache, cpu->loaded);
+      if (cpu->previous != NULL)
+	drained += _objs_magazine_destroy(cache, cpu->previous);
+
+      cpu->loaded   = NULL;
+      cpu->previous = NULL;
+    }
+
+  while (!list_is_empty(cache->depot_full))
+    drained += _objs_magazine_destroy(cache, list_pop_head(cache->depot_full));
+
+  while (!list_is_empty(cache->depot_empty))
+    _objs_magazine_destroy(cache, list_pop_head(cache->depot_empty));
+
+  cache->depot_full_count  = 0;
+  cache->depot_empty_count = 0;
+
+  return drained;
 }
 
 
@@ -585,7 +1041,8 @@ void *_retrieve_free_obj_from_objs_cache(Objs_cache *cache)
 }
 
 /* This function adds a new slab to the object cache for Vregion objects without
- * relying on obj_cache_alloc() and create_slab()
+ * relying on obj_cache_alloc() and create_slab(): it is called by the virtual
+ * pages allocator to keep its reserve of Vregion objects.
  */
 void _create_slab_for_cache_Vregion(void)
 {
@@ -593,55 +1050,21 @@ void _create_slab_for_cache_Vregion(void)
   KASSERT(cache_Vregion->pages_per_slab == VPAGES_PER_SLAB_CACHE_VREGION);
   
   Vregion *a_vregion = _vregion_alloc(VPAGES_PER_SLAB_CACHE_VREGION);
-  Slab *a_slab       = _retrieve_free_obj_from_objs_cache(cache_Slab);
 
   KASSERT(a_vregion != NULL);
-  KASSERT(a_slab != NULL);
   
-  ppn_t slab_ppages = ppages_alloc(VPAGES_PER_SLAB_CACHE_VREGION);
+  ppn_t slab_ppages = ppages_alloc_exact(VPAGES_PER_SLAB_CACHE_VREGION);
   map_pages(slab_ppages,
 	    vregion_first_vpn(a_vregion),
 	    VPAGES_PER_SLAB_CACHE_VREGION,
 	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
   
-  kprintf("TODO : reference the slab in the Ppage structures in %s()\n", __func__);
-  
-  initialize_slab(a_slab, a_vregion, cache_Vregion->actual_obj_size, 0);
-
-  objs_cache_add_slab(cache_Vregion, a_slab, SLAB_STATUS_FREE);
+  Slab *a_slab = slab_header_of(a_vregion);
+  initialize_slab(a_slab, a_vregion, cache_Vregion->actual_obj_size, _objs_cache_next_colour_offset(cache_Vregion), 0);
 
-  if (cache_Slab->free_objs_count == MIN_FREE_OBJS_CACHE_SLAB - 1)
-    _create_slab_for_cache_Slab();
-}
+  ppages_set_slab(slab_ppages, VPAGES_PER_SLAB_CACHE_VREGION, a_slab);
 
-/* This function adds a new slab to the object cache for Slab objects without
- * relying on obj_cache_alloc() and create_slab()
- */
-static void _create_slab_for_cache_Slab(void)
-{
-  KASSERT(cache_Slab->free_objs_count >= (MIN_FREE_OBJS_CACHE_SLAB - 1));
-  KASSERT(cache_Slab->pages_per_slab == VPAGES_PER_SLAB_CACHE_SLAB);
-  
-  Vregion *a_vregion = _vregion_alloc(VPAGES_PER_SLAB_CACHE_VREGION);
-  Slab *a_slab       = _retrieve_free_obj_from_objs_cache(cache_Slab);
-
-  KASSERT(a_vregion != NULL);
-  KASSERT(a_slab != NULL);
-  
-  ppn_t slab_ppages = ppages_alloc(VPAGES_PER_SLAB_CACHE_SLAB);
-  map_pages(slab_ppages,
-	    vregion_first_vpn(a_vregion),
-	    VPAGES_PER_SLAB_CACHE_SLAB,
-	    PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
-  
-  kprintf("TODO : reference the slab in the Ppage structures in %s()\n", __func__);
-  
-  initialize_slab(a_slab, a_vregion, cache_Slab->actual_obj_size, 0);
-
-  objs_cache_add_slab(cache_Slab, a_slab, SLAB_STATUS_FREE);
-
-  if (cache_Vregion->free_objs_count == MIN_FREE_OBJS_CACHE_VREGION - 1)
-    _create_slab_for_cache_Vregion();
+  objs_cache_add_slab(cache_Vregion, a_slab, SLAB_STATUS_FREE);
 }
 
 void DEBUG_dump_objs_cache(Objs_cache *cache)
@@ -652,28 +1075,40 @@ void DEBUG_dump_objs_cache(Objs_cache *cache)
   kprintf("  cache name : %s\n"\
 	  "  obj_size : %u\n"\
 	  "  actual_obj_size : %u\n"
+	  "  align : %u\n"
 	  "  pages_per_slab : %u\n"
 	  "  slab_size : %u\n"\
 	  "  objs_per_slab : %u\n"\
 	  "  wasted_memory_per_slab : %u\n"\
+	  "  colours : %u (offsets 0 to %u, step %u)\n"\
 	  "  free_objs_count : %u\n"\
 	  "  used_objs_count : %u\n"\
 	  "  slabs_count : %u\n"\
 	  "  free_slabs_count : %u\n"\
 	  "  partial_slabs_count : %u\n"\
-	  "  full_slabs_count : %u\n",
+	  "  full_slabs_count : %u\n"\
+	  "  magazine_size : %u\n"\
+	  "  depot_full_count : %u\n"\
+	  "  depot_empty_count : %u\n",
 	  cache->name,
 	  cache->obj_size,
 	  cache->actual_obj_size,
+	  cache->align,
 	  cache->pages_per_slab,
 	  cache->slab_size,
 	  cache->objs_per_slab,
 	  cache->wasted_memory_per_slab,
+	  cache->colours_count,
+	  (cache->colours_count - 1) * cache->colour_step,
+	  cache->colour_step,
 	  cache->free_objs_count,
 	  cache->used_objs_count,
 	  cache->slabs_count,
 	  cache->free_slabs_count,
 	  cache->partial_slabs_count,
-	  cache->full_slabs_count);
+	  cache->full_slabs_count,
+	  cache->magazine_size,
+	  cache->depot_full_count,
+	  cache->depot_empty_count);
 }
     
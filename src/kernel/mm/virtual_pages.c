@@ -1,10 +1,14 @@
 #include <types.h>
 
-#include <kernel/list.h>
+#include <kernel/avl.h>
 #include <kernel/kprintf.h>
 #include <kernel/panic.h>
 #include <kernel/mm/slab.h>
 #include <kernel/mm/virtual_pages.h>
+#include <kernel/mm/physical_pages.h>
+
+#include <x86/paging.h>
+#include <x86/x86.h>
 
 
 /*************************************************
@@ -18,23 +22,64 @@ static vpn_t _boot_last_free_vpn;
 //static vpn_t last_free_vpn;
 
 
-static Vregion *free_vregions = NULL;
-static Vregion *used_vregions = NULL;
+/* Free regions are linked in two trees: by address (to find the neighbours
+ * of a region) and by size (for the best-fit allocation). Used regions are
+ * only sorted by address (to find the region owning a virtual address).
+ */
+static Avl_tree free_vregions_by_addr;
+static Avl_tree free_vregions_by_size;
+static Avl_tree used_vregions;
 
 static Objs_cache *cache_Vregion;
 
+static Vregions_cpu_cache vregions_cpu_caches[MAX_CPUS];
+
 
-static inline int32_t vregion_cmp(const Vregion *vregion1, const Vregion *vregion2)
+static int32_t vregion_addr_cmp(const Avl_node *node1, const Avl_node *node2)
 {
-  KASSERT(vregion1 != NULL);
-  KASSERT(vregion2 != NULL);
-  KASSERT((vregion_first_vpn(vregion1) <= vregion_first_vpn(vregion2) &&
-	   vregion_last_vpn(vregion1) <= vregion_last_vpn(vregion2)) ||
-	  (vregion_first_vpn(vregion2) <= vregion_first_vpn(vregion1) &&
-	   vregion_last_vpn(vregion2) <= vregion_last_vpn(vregion1)));
-  
-  return (vregion_first_vpn(vregion2) == vregion_first_vpn(vregion1) ? 0 :
-	  (vregion_first_vpn(vregion2) > vregion_first_vpn(vregion1) ? 1 : -1));
+  const Vregion *vregion1 = avl_entry(node1, Vregion, addr_node);
+  const Vregion *vregion2 = avl_entry(node2, Vregion, addr_node);
+
+  //Regions in the same tree never overlap
+  KASSERT(vregion_last_vpn(vregion1) < vregion_first_vpn(vregion2) ||
+	  vregion_last_vpn(vregion2) < vregion_first_vpn(vregion1));
+
+  return (vregion_first_vpn(vregion1) == vregion_first_vpn(vregion2) ? 0 :
+	  (vregion_first_vpn(vregion1) < vregion_first_vpn(vregion2) ? -1 : 1));
+}
+
+static int32_t vregion_size_cmp(const Avl_node *node1, const Avl_node *node2)
+{
+  const Vregion *vregion1 = avl_entry(node1, Vregion, size_node);
+  const Vregion *vregion2 = avl_entry(node2, Vregion, size_node);
+
+  if (vregion1->nbr_pages != vregion2->nbr_pages)
+    return (vregion1->nbr_pages < vregion2->nbr_pages ? -1 : 1);
+
+  return (vregion_first_vpn(vregion1) == vregion_first_vpn(vregion2) ? 0 :
+	  (vregion_first_vpn(vregion1) < vregion_first_vpn(vregion2) ? -1 : 1));
+}
+
+/* key is a pointer to a vpn_t, a region matches if it contains this page */
+static int32_t vregion_vpn_key_cmp(const void *key, const Avl_node *node)
+{
+  vpn_t vpn = *(const vpn_t*)key;
+  const Vregion *vregion = avl_entry(node, Vregion, addr_node);
+
+  if (vpn < vregion_first_vpn(vregion))
+    return -1;
+
+  return (vpn > vregion_last_vpn(vregion) ? 1 : 0);
+}
+
+/* key is a pointer to a size_t (a number of pages) */
+static int32_t vregion_size_key_cmp(const void *key, const Avl_node *node)
+{
+  size_t nbr_pages = *(const size_t*)key;
+  const Vregion *vregion = avl_entry(node, Vregion, size_node);
+
+  return (nbr_pages == vregion->nbr_pages ? 0 :
+	  (nbr_pages < vregion->nbr_pages ? -1 : 1));
 }
 
 inline vaddr_t vpage_vaddr_of(vaddr_t vaddr)
@@ -73,6 +118,18 @@ inline vpn_t vregion_last_vpn(const Vregion *vregion)
           Private functions
 ******************************************/
 
+static inline void free_vregion_insert(Vregion *vregion)
+{
+  avl_insert(&free_vregions_by_addr, &vregion->addr_node);
+  avl_insert(&free_vregions_by_size, &vregion->size_node);
+}
+
+static inline void free_vregion_delete(Vregion *vregion)
+{
+  avl_delete(&free_vregions_by_addr, &vregion->addr_node);
+  avl_delete(&free_vregions_by_size, &vregion->size_node);
+}
+
 
 /* Try to split the given Vregion in two :
  *  - the resulting lower part (vregion_to_split) will contain nbr_pages
@@ -99,32 +156,106 @@ static  Vregion *vregion_split(Vregion *vregion_to_split, size_t nbr_pages)
 }
 
 
-static Vregion *vregion_merge(Vregion *vregion1, Vregion *vregion2)
+/* The upper region is appended to the lower one, which must be just below.
+ * Both regions must be out of the trees whose order depends on their size,
+ * the descriptor of the upper region is released.
+ */
+static Vregion *vregion_merge(Vregion *vregion_lower, Vregion *vregion_upper)
 {
-  Vregion *to_return = NULL;
-  
-  KASSERT(vregion1 != NULL);
-  KASSERT(vregion2 != NULL);
+  KASSERT(vregion_lower != NULL);
+  KASSERT(vregion_upper != NULL);
+  KASSERT((vregion_last_vpn(vregion_lower) + 1) == vregion_first_vpn(vregion_upper));
+
+  vregion_lower->nbr_pages += vregion_upper->nbr_pages;
+  objs_cache_free(cache_Vregion, vregion_upper);
+
+  return vregion_lower;
+}
 
-  if (vregion_first_vpn(vregion1) > vregion_first_vpn(vregion2))
+/* Inserts a region in the free trees, coalesced with its free neighbours */
+static void free_vregion_insert_coalesced(Vregion *vregion)
+{
+  Avl_node *prev = NULL;
+  Avl_node *next = NULL;
+
+  //The neighbours are found in O(log n) once the region is in the address tree
+  avl_insert(&free_vregions_by_addr, &vregion->addr_node);
+  prev = avl_prev(&vregion->addr_node);
+  next = avl_next(&vregion->addr_node);
+
+  if (prev != NULL &&
+      vregion_last_vpn(avl_entry(prev, Vregion, addr_node)) + 1 == vregion_first_vpn(vregion))
     {
-      Vregion *tmp_vregion = vregion1;
-      vregion1 = vregion2;
-      vregion2 = tmp_vregion;
+      Vregion *lower = avl_entry(prev, Vregion, addr_node);
+
+      //The lower neighbour keeps its place in the address tree
+      avl_delete(&free_vregions_by_addr, &vregion->addr_node);
+      avl_delete(&free_vregions_by_size, &lower->size_node);
+      vregion = vregion_merge(lower, vregion);
     }
 
-  if ((vregion_last_vpn(vregion1) + 1) == vregion_first_vpn(vregion2))
+  if (next != NULL &&
+      vregion_last_vpn(vregion) + 1 == vregion_first_vpn(avl_entry(next, Vregion, addr_node)))
     {
-      vregion1->nbr_pages += vregion2->nbr_pages;
-      objs_cache_free(cache_Vregion, vregion2);
-      
-      to_return = vregion1;
+      Vregion *upper = avl_entry(next, Vregion, addr_node);
+
+      free_vregion_delete(upper);
+      vregion = vregion_merge(vregion, upper);
     }
 
-  return to_return;
+  avl_insert(&free_vregions_by_size, &vregion->size_node);
 }
 
 
+/* Reserve a batch of pages in the global trees and cut it into single-page
+ * regions for a CPU cache. The cost of the trees and of cache_Vregion is
+ * paid once per batch.
+ * Creating a slab for cache_Vregion may reclaim memory, and the shrinkers
+ * free single-page regions into this same cache: the batch is cut aside and
+ * the regions which don't fit in the cache anymore go back to the trees.
+ */
+static void _vregions_cpu_cache_refill(Vregions_cpu_cache *cache)
+{
+  Vregion *vregions[VREGIONS_CPU_CACHE_BATCH];
+  uint32_t nbr_vregions = 0;
+  Vregion *batch = vregion_alloc(VREGIONS_CPU_CACHE_BATCH);
+
+  if (batch == NULL)
+    return;
+
+  while (batch->nbr_pages > 1)
+    {
+      Vregion *upper_part = NULL;
+
+      if (cache_Vregion->free_objs_count == MIN_FREE_OBJS_CACHE_VREGION)
+	_create_slab_for_cache_Vregion();
+
+      //The lower page keeps its place in the used tree, the rest is inserted
+      upper_part = vregion_split(batch, 1);
+      upper_part->flags = 0;
+      avl_insert(&used_vregions, &upper_part->addr_node);
+
+      vregions[nbr_vregions++] = batch;
+      batch = upper_part;
+    }
+
+  vregions[nbr_vregions++] = batch;
+
+  for (uint32_t i = 0; i < nbr_vregions; i++)
+    {
+      if (cache->count < VREGIONS_CPU_CACHE_HIGH)
+	{
+	  vregions[i]->flags = VREGION_CACHED;
+	  cache->vregions[cache->count++] = vregions[i];
+	}
+      else
+	{
+	  avl_delete(&used_vregions, &vregions[i]->addr_node);
+	  free_vregion_insert_coalesced(vregions[i]);
+	}
+    }
+}
+
 /*****************************************
           Public functions
 ******************************************/
@@ -153,43 +284,47 @@ vpn_t _boot_virtual_pages_alloc(uint32_t nbr_vpages)
 }
 
 
-void virtual_page_boot_init(Objs_cache *cache, Vregion *first_used_vregion)
+void virtual_page_boot_init(Objs_cache *cache, Vregion *used_vregions_array, uint32_t nbr_used_vregions)
 {
+  Vregion *free_vregion = NULL;
+  Avl_node *current = NULL;
+  Avl_node *next = NULL;
+  uint32_t i;
+
   KASSERT(cache != NULL);
-  KASSERT(first_used_vregion != NULL);
+  KASSERT(used_vregions_array != NULL);
   KASSERT(cache->free_objs_count > MIN_FREE_OBJS_CACHE_VREGION);
   
   cache_Vregion = cache;
-  used_vregions = first_used_vregion;
 
-  Vregion *current = first_used_vregion;
-  Vregion *next    = NULL;
+  avl_init(&free_vregions_by_addr, vregion_addr_cmp);
+  avl_init(&free_vregions_by_size, vregion_size_cmp);
+  avl_init(&used_vregions, vregion_addr_cmp);
 
-  //We check if the initial list of used vregions is properly orderd
-  while (current != NULL)
+  for (i = 0 ; i < MAX_CPUS ; i++)
+    vregions_cpu_caches[i].count = 0;
+
+  for (i = 0 ; i < nbr_used_vregions ; i++)
+    avl_insert(&used_vregions, &used_vregions_array[i].addr_node);
+
+  //We check that the initial used vregions don't overlap each other
+  for (current = avl_first(&used_vregions) ; current != NULL ; current = next)
     {
-      next = current->next;
-      if (next != NULL)
+      next = avl_next(current);
+      if (next != NULL &&
+	  vregion_last_vpn(avl_entry(current, Vregion, addr_node)) >= vregion_first_vpn(avl_entry(next, Vregion, addr_node)))
 	{
-	  if (vregion_first_vpn(current) > vregion_first_vpn(next))
-	    {
-	      panic("Used vregions are unproperly ordered in %s!\n", __func__);
-	    }
-	  else if (vregion_last_vpn(current) >= vregion_first_vpn(next))
-	    {
-	      panic("A virtual region is overlapping an other one in %s!\n", __func__);
-	    }
-	    
+	  panic("A virtual region is overlapping an other one in %s!\n", __func__);
 	}
-      current = next;
     }
   
-  free_vregions = objs_cache_alloc(cache_Vregion);
+  free_vregion = objs_cache_alloc(cache_Vregion);
 
-  if (free_vregions == NULL)
+  if (free_vregion == NULL)
     panic("Failed to allocate a Vregion in %s()\n", __func__);
 
-  vregion_init(free_vregions, _boot_first_free_vpn, _boot_last_free_vpn - _boot_first_free_vpn + 1);
+  vregion_init(free_vregion, _boot_first_free_vpn, _boot_last_free_vpn - _boot_first_free_vpn + 1);
+  free_vregion_insert(free_vregion);
 }
 
 void vregion_init(Vregion *region, vpn_t first_vpn, uint32_t nbr_pages)
@@ -200,6 +335,7 @@ void vregion_init(Vregion *region, vpn_t first_vpn, uint32_t nbr_pages)
     {
       region->first_vpn = first_vpn;
       region->nbr_pages = nbr_pages;
+      region->flags     = 0;
     }
 }
 
@@ -207,6 +343,22 @@ Vregion *vregion_alloc(uint32_t nbr_pages)
 {
   Vregion *allocated_vregion = NULL;
 
+  //Fast path: single pages come from the CPU cache
+  if (nbr_pages == 1)
+    {
+      Vregions_cpu_cache *cache = &vregions_cpu_caches[current_cpu_id()];
+
+      if (cache->count == 0)
+	_vregions_cpu_cache_refill(cache);
+
+      if (cache->count > 0)
+	{
+	  allocated_vregion = cache->vregions[--cache->count];
+	  allocated_vregion->flags = 0;
+	  return allocated_vregion;
+	}
+    }
+
   KASSERT(cache_Vregion->free_objs_count >= MIN_FREE_OBJS_CACHE_VREGION);
   
   if (cache_Vregion->free_objs_count == MIN_FREE_OBJS_CACHE_VREGION)
@@ -219,70 +371,242 @@ Vregion *vregion_alloc(uint32_t nbr_pages)
   return allocated_vregion;
 }
 
+/* Best-fit: the smallest free region large enough (the lowest one among
+ * regions of the same size), found in O(log n) in the tree sorted by size.
+ */
 Vregion *_vregion_alloc(uint32_t nbr_pages)
 {
-  Vregion *prev = NULL;
-  Vregion *current = free_vregions;
+  size_t key = nbr_pages;
+  Avl_node *node = NULL;
+  Vregion *found = NULL;
 
-  KASSERT(current != NULL);
-  //We look for the first region which has at least the required number of pages
-  while (current != NULL)
-    {
-      if (current->nbr_pages >= nbr_pages)
-	break;
+  KASSERT(!avl_is_empty(&free_vregions_by_size));
 
-      prev = current;
-      current = current->next;
-    }
+  node = avl_search_ge(&free_vregions_by_size, &key, vregion_size_key_cmp);
 
-  //If the virtual region found is too big we try to split it
-  if (current != NULL)
+  //If the virtual region found is too big we split it
+  if (node != NULL)
     {
-      list_delete_el(free_vregions, prev, current);
+      found = avl_entry(node, Vregion, size_node);
+      free_vregion_delete(found);
       
-      if (current->nbr_pages > nbr_pages)
+      if (found->nbr_pages > nbr_pages)
 	{
 	  Vregion *upper_part = NULL;
 
-	  upper_part = vregion_split(current, nbr_pages);
+	  upper_part = vregion_split(found, nbr_pages);
 	  KASSERT(upper_part != NULL);
-	  list_insert_after(free_vregions, prev, upper_part);
+	  free_vregion_insert(upper_part);
+	}
+
+      found->flags = 0;
+      avl_insert(&used_vregions, &found->addr_node);
+    }
+
+  return found;
+}
+
+/**
+ * \fn Vregion *vregion_alloc_lazy(uint32_t nbr_pages)
+ * \brief Reserve a kernel virtual region without backing it.
+ * \param nbr_pages The number of virtual pages to reserve.
+ * \return The reserved Vregion, NULL if the virtual space is exhausted.
+ *
+ * Each page gets a zeroed physical page on its first access, through
+ * vregion_page_fault(). The untouched pages cost no physical memory.
+ */
+Vregion *vregion_alloc_lazy(uint32_t nbr_pages)
+{
+  Vregion *allocated_vregion = vregion_alloc(nbr_pages);
+
+  if (allocated_vregion != NULL)
+    allocated_vregion->flags |= VREGION_LAZY;
+
+  return allocated_vregion;
+}
+
+/**
+ * \fn void vregion_free(Vregion *vregion)
+ * \brief Free an allocated virtual region.
+ * \param vregion The region, given by vregion_alloc().
+ *
+ * The pages of the region are unmapped and the physical pages which were
+ * mapped are given back to the physical pages allocator. The region must
+ * map whole allocations (every page of a block, from its head), a frame
+ * shared with other mappings is only unreferenced. The region is then
+ * coalesced with its free neighbours, in O(log n), or kept in the CPU cache
+ * if it is a single page.
+ */
+void vregion_free(Vregion *vregion)
+{
+  ppn_t ppns[VPAGES_FREE_BATCH];
+  uint32_t nbr_ppns = 0;
+  ppn_t block_next_ppn = 0; //Next page expected in the physical block being released
+  ppn_t block_end_ppn  = 0; //First page after this block
+
+  KASSERT(vregion != NULL);
+
+  if (vregion->flags & VREGION_CACHED)
+    panic("Region %p freed twice in %s()\n", vpn_to_vaddr(vregion_first_vpn(vregion)), __func__);
+
+  KASSERT(vaddr_to_vregion(vpn_to_vaddr(vregion_first_vpn(vregion))) == vregion);
+
+  for (vpn_t vpn = vregion_first_vpn(vregion); vpn <= vregion_last_vpn(vregion); vpn++)
+    {
+      paddr_t paddr = virt_to_phys_addr(vpn_to_vaddr(vpn));
+
+      //The page may never have been mapped
+      if (paddr == (paddr_t)NULL)
+	continue;
+
+      ppn_t ppn = paddr_to_ppn(paddr);
+      Ppage *ppage = ppn_to_ppage(ppn);
+
+      unmap_page(vpn);
+
+      //A frame still mapped elsewhere only loses the reference of this mapping
+      if (ppage_count(ppage) > 1)
+	{
+	  KASSERT(block_next_ppn == block_end_ppn);
+	  KASSERT(ppage_is_block_head(ppage) && ppage_block_order(ppage) == 0);
+	  ppage_unref(ppage);
+	  continue;
+	}
+
+      //The region must own whole allocations: each block is mapped from its head, in order
+      if (block_next_ppn == block_end_ppn)
+	{
+	  KASSERT(ppage_is_block_head(ppage));
+	  block_end_ppn = ppn + (1UL << ppage_block_order(ppage));
+	}
+      else
+	{
+	  KASSERT(ppn == block_next_ppn);
+	}
+
+      block_next_ppn = ppn + 1;
+      ppns[nbr_ppns++] = ppn;
+
+      if (nbr_ppns == VPAGES_FREE_BATCH)
+	{
+	  ppages_release_bulk(ppns, nbr_ppns);
+	  nbr_ppns = 0;
 	}
+    }
+
+  KASSERT(block_next_ppn == block_end_ppn);
+
+  if (nbr_ppns > 0)
+    ppages_release_bulk(ppns, nbr_ppns);
+
+  //A single page stays reserved in the CPU cache, unless the cache is full
+  if (vregion->nbr_pages == 1)
+    {
+      Vregions_cpu_cache *cache = &vregions_cpu_caches[current_cpu_id()];
+
+      if (cache->count < VREGIONS_CPU_CACHE_HIGH)
+	{
+	  //Not lazy anymore: a stale access faults instead of mapping a new page
+	  vregion->flags = VREGION_CACHED;
+	  cache->vregions[cache->count++] = vregion;
+	  return;
+	}
+    }
+
+  avl_delete(&used_vregions, &vregion->addr_node);
+  free_vregion_insert_coalesced(vregion);
+}
+
+/**
+ * \fn bool_t vregion_page_fault(vaddr_t fault_vaddr)
+ * \brief Back a page of a lazy kernel region on its first access.
+ * \param fault_vaddr The address which caused a non-present page fault.
+ * \return TRUE if the page has been mapped and the access can be restarted,
+ *         FALSE if the address is not in a lazy region or if the physical
+ *         memory is exhausted.
+ */
+bool_t vregion_page_fault(vaddr_t fault_vaddr)
+{
+  Vregion *vregion = NULL;
+  Ppage *ppage = NULL;
+
+  if (fault_vaddr < KERNEL_SPACE)
+    return FALSE;
+
+  vregion = vaddr_to_vregion(fault_vaddr);
+
+  if (vregion == NULL || !(vregion->flags & VREGION_LAZY))
+    return FALSE;
 
-      list_insert_ordered(used_vregions, current, vregion_cmp);
+  ppage = _ppage_alloc_zeroed();
+
+  if (ppage == NULL)
+    {
+#ifdef DEBUG
+      kprintf("No physical page to back %p in %s\n", fault_vaddr, __func__);
+#endif
+      return FALSE;
     }
 
-  return current;
+  map_page(ppage_to_ppn(ppage),
+	   vaddr_to_vpn(fault_vaddr),
+	   PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR | PAGE_GLOBAL);
+
+  return TRUE;
+}
+
+/**
+ * \fn Vregion *vaddr_to_vregion(vaddr_t vaddr)
+ * \brief Looks for the used virtual region containing a virtual address, in O(log n).
+ * \param vaddr The virtual address.
+ * \return The Vregion containing vaddr, or NULL if vaddr isn't in an allocated region.
+ */
+Vregion *vaddr_to_vregion(vaddr_t vaddr)
+{
+  vpn_t vpn = vaddr_to_vpn(vaddr);
+  Avl_node *node = avl_search_le(&used_vregions, &vpn, vregion_vpn_key_cmp);
+
+  if (node == NULL)
+    return NULL;
+
+  Vregion *vregion = avl_entry(node, Vregion, addr_node);
+
+  //The single pages kept in the CPU caches are free
+  if (vpn > vregion_last_vpn(vregion) || (vregion->flags & VREGION_CACHED))
+    return NULL;
+
+  return vregion;
 }
 
 
 void DEBUG_dump_free_vregions(void)
 {
-  Vregion *current = free_vregions;
+  Avl_node *current = avl_first(&free_vregions_by_addr);
 
   kprintf("%s()\n",__func__);
   kprintf("  Free virtual regions :\n  ");
   
   while (current != NULL)
     {
-      kprintf("[%u , %u] - ", vregion_first_vpn(current), vregion_last_vpn(current));
-      current = current->next;
+      Vregion *vregion = avl_entry(current, Vregion, addr_node);
+      kprintf("[%u , %u] - ", vregion_first_vpn(vregion), vregion_last_vpn(vregion));
+      current = avl_next(current);
     }
   kprintf("\n");
 }
 
 void DEBUG_dump_used_vregions(void)
 {
-  Vregion *current = used_vregions;
+  Avl_node *current = avl_first(&used_vregions);
 
   kprintf("%s()\n",__func__);
   kprintf("  Used virtual regions :\n  ");
   
   while (current != NULL)
     {
-      kprintf("[%u , %u] - ", vregion_first_vpn(current), vregion_last_vpn(current));
-      current = current->next;
+      Vregion *vregion = avl_entry(current, Vregion, addr_node);
+      kprintf("[%u , %u] - ", vregion_first_vpn(vregion), vregion_last_vpn(vregion));
+      current = avl_next(current);
     }
   kprintf("\n");
 }
-
@@ -0,0 +1,32 @@
+/**
+ * \file test/host/host.h
+ * \brief Linux environment of the host harness of the memory allocators.
+ *
+ * The allocators are built unchanged, with the flags of the kernel, as an
+ * i386 Linux program which does not need any C library: the few system
+ * calls needed are made directly.
+ * The physical memory is simulated by a memory file of HOST_RAM_SIZE bytes,
+ * map_page() maps its pages with mmap() at the kernel virtual address asked
+ * for, so that the pointers handed out by the allocators can be used as is.
+ */
+#ifndef TEST_HOST_HOST_H
+#define TEST_HOST_HOST_H
+
+#include <types.h>
+
+#define HOST_RAM_SIZE (32 * MB)          /**< Size of the simulated physical memory*/
+#define HOST_PHYS_VIEW 0xA0000000        /**< The whole simulated memory is also mapped here, to check the content of the pages*/
+#define HOST_KERNEL_SPACE_END 0xE0000000 /**< End of the kernel virtual space given to the allocators*/
+
+int32_t host_main(void);
+void host_exit(int32_t status) __attribute__ ((__noreturn__));
+
+void host_ram_init(void);
+void *host_phys_to_ptr(paddr_t paddr);
+uint32_t host_mapped_vpages_count(void);
+
+uint32_t host_clock_ns(void);
+
+bool_t host_expect_panic(void (*fn)(void));
+
+#endif
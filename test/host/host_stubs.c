@@ -0,0 +1,335 @@
+/**
+ * \file test/host/host_stubs.c
+ * \brief Entry point, Linux system calls, simulated RAM and the stubs of the
+ *        kernel functions (paging, kprintf, panic) used by the allocators.
+ */
+#include <types.h>
+#include <stdarg.h>
+
+#include <kernel/kernel.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+
+#include <kernel/mm/physical_pages.h>
+#include <kernel/mm/virtual_pages.h>
+
+#include <x86/paging.h>
+
+#include "host.h"
+
+//Linux i386 system calls
+#define HOST_SYS_FORK          2
+#define HOST_SYS_WRITE         4
+#define HOST_SYS_WAITPID       7
+#define HOST_SYS_MMAP          90 //Old mmap(): the arguments are given in a structure
+#define HOST_SYS_MUNMAP        91
+#define HOST_SYS_FTRUNCATE     93
+#define HOST_SYS_EXIT_GROUP    252
+#define HOST_SYS_CLOCK_GETTIME 265
+#define HOST_SYS_MEMFD_CREATE  356
+
+#define HOST_PROT_READ_WRITE     3
+#define HOST_MAP_SHARED          0x01
+#define HOST_MAP_FIXED           0x10
+#define HOST_MAP_FIXED_NOREPLACE 0x100000 //Fails instead of replacing a mapping of the harness itself
+#define HOST_CLOCK_MONOTONIC     1
+
+#define HOST_KERNEL_VPAGES ((HOST_KERNEL_SPACE_END - KERNEL_SPACE) >> VPAGE_SHIFT)
+
+struct Host_mmap_args{
+  uint32_t addr;
+  uint32_t len;
+  uint32_t prot;
+  uint32_t flags;
+  uint32_t fd;
+  uint32_t offset;
+};
+
+struct Host_timespec{
+  int32_t tv_sec;
+  int32_t tv_nsec;
+};
+
+static int32_t host_ram_fd = -1;
+
+//ppn + 1 of the page mapped at each kernel virtual page, 0 if none
+static uint32_t host_page_table[HOST_KERNEL_VPAGES];
+static uint32_t host_mapped_vpages = 0;
+
+static char host_buffer[1024];
+
+//Set in the child process of host_expect_panic(), where a panic is the expected outcome
+static bool_t host_quiet_panic = FALSE;
+
+/* The harness is linked without any C library: the stack is aligned, then
+ * host_main() is called and its result is the exit status.
+ */
+asm(".text\n"
+    ".globl _start\n"
+    "_start:\n"
+    "\txor %ebp, %ebp\n"
+    "\tand $-16, %esp\n"
+    "\tcall host_main\n"
+    "\tpush %eax\n"
+    "\tcall host_exit\n");
+
+
+/*****************************************
+          Private functions
+******************************************/
+
+/* ebx may hold the GOT pointer: the first argument goes through esi */
+static int32_t _host_syscall(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+  int32_t ret;
+
+  asm volatile("xchg %%esi, %%ebx\n\t"
+	       "int $0x80\n\t"
+	       "xchg %%esi, %%ebx"
+	       : "=a" (ret)
+	       : "0" (nr), "S" (arg1), "c" (arg2), "d" (arg3)
+	       : "memory");
+
+  return ret;
+}
+
+static void _host_write(const char *str, uint32_t len)
+{
+  _host_syscall(HOST_SYS_WRITE, 1, (uint32_t)str, len);
+}
+
+/* Map a part of the simulated RAM, return the address of the mapping or an
+ * error code (between -4095 and -1)
+ */
+static vaddr_t _host_mmap(vaddr_t vaddr, size_t size, uint32_t flags, paddr_t offset)
+{
+  struct Host_mmap_args args = {vaddr, size, HOST_PROT_READ_WRITE, flags, (uint32_t)host_ram_fd, offset};
+  int32_t ret = _host_syscall(HOST_SYS_MMAP, (uint32_t)&args, 0, 0);
+
+  return (vaddr_t)ret;
+}
+
+/* Give the process its own copy of the simulated RAM: the memory file is
+ * shared with the parent after a fork()
+ */
+static void _host_ram_copy(void)
+{
+  int32_t ram_fd = _host_syscall(HOST_SYS_MEMFD_CREATE, (uint32_t)"host_ram", 0, 0);
+
+  if (ram_fd < 0)
+    panic("memfd_create() failed (%d) in %s()\n", ram_fd, __func__);
+
+  for (uint32_t offset = 0; offset < HOST_RAM_SIZE; )
+    {
+      int32_t written = _host_syscall(HOST_SYS_WRITE, (uint32_t)ram_fd, HOST_PHYS_VIEW + offset, HOST_RAM_SIZE - offset);
+
+      if (written <= 0)
+	panic("Failed to copy the simulated RAM in %s()\n", __func__);
+
+      offset += (uint32_t)written;
+    }
+
+  host_ram_fd = ram_fd;
+
+  if (_host_mmap(HOST_PHYS_VIEW, HOST_RAM_SIZE, HOST_MAP_SHARED | HOST_MAP_FIXED, 0) != HOST_PHYS_VIEW)
+    panic("Failed to map the simulated RAM in %s()\n", __func__);
+
+  for (uint32_t i = 0; i < HOST_KERNEL_VPAGES; i++)
+    {
+      vaddr_t vaddr = KERNEL_SPACE + (i << VPAGE_SHIFT);
+
+      if (host_page_table[i] != 0 &&
+	  _host_mmap(vaddr, VPAGE_SIZE, HOST_MAP_SHARED | HOST_MAP_FIXED, ppn_to_paddr(host_page_table[i] - 1)) != vaddr)
+	panic("Failed to map the virtual address %p in %s()\n", vaddr, __func__);
+    }
+}
+
+static uint32_t _host_vpn_index(vpn_t vpn)
+{
+  if (vpn < vaddr_to_vpn(KERNEL_SPACE) || vpn >= vaddr_to_vpn(HOST_KERNEL_SPACE_END))
+    panic("Virtual page %u out of the kernel space of the harness in %s()\n", vpn, __func__);
+
+  return vpn - vaddr_to_vpn(KERNEL_SPACE);
+}
+
+
+/*****************************************
+          Public functions
+******************************************/
+
+void host_exit(int32_t status)
+{
+  for (;;)
+    _host_syscall(HOST_SYS_EXIT_GROUP, (uint32_t)status, 0, 0);
+}
+
+/**
+ * \fn void host_ram_init(void)
+ * \brief Create the simulated RAM and map all of it at HOST_PHYS_VIEW.
+ */
+void host_ram_init(void)
+{
+  host_ram_fd = _host_syscall(HOST_SYS_MEMFD_CREATE, (uint32_t)"host_ram", 0, 0);
+
+  if (host_ram_fd < 0)
+    panic("memfd_create() failed (%d) in %s()\n", host_ram_fd, __func__);
+
+  if (_host_syscall(HOST_SYS_FTRUNCATE, (uint32_t)host_ram_fd, HOST_RAM_SIZE, 0) != 0)
+    panic("Failed to size the simulated RAM in %s()\n", __func__);
+
+  if (_host_mmap(HOST_PHYS_VIEW, HOST_RAM_SIZE, HOST_MAP_SHARED | HOST_MAP_FIXED_NOREPLACE, 0) != HOST_PHYS_VIEW)
+    panic("Failed to map the simulated RAM in %s()\n", __func__);
+}
+
+/**
+ * \fn void *host_phys_to_ptr(paddr_t paddr)
+ * \brief Access the simulated RAM without going through the kernel mappings.
+ */
+void *host_phys_to_ptr(paddr_t paddr)
+{
+  KASSERT(paddr < HOST_RAM_SIZE);
+
+  return (void*)(HOST_PHYS_VIEW + paddr);
+}
+
+/**
+ * \fn uint32_t host_mapped_vpages_count(void)
+ * \return The number of kernel virtual pages currently mapped.
+ */
+uint32_t host_mapped_vpages_count(void)
+{
+  return host_mapped_vpages;
+}
+
+/**
+ * \fn uint32_t host_clock_ns(void)
+ * \brief Read the monotonic clock of the host.
+ * \return A time in nanoseconds, modulo 2^32: only the differences of two
+ *         readings less than 4 seconds apart are meaningful.
+ */
+uint32_t host_clock_ns(void)
+{
+  struct Host_timespec now;
+
+  _host_syscall(HOST_SYS_CLOCK_GETTIME, HOST_CLOCK_MONOTONIC, (uint32_t)&now, 0);
+
+  return (uint32_t)now.tv_sec * 1000000000UL + (uint32_t)now.tv_nsec;
+}
+
+/**
+ * \fn bool_t host_expect_panic(void (*fn)(void))
+ * \brief Run a function in a child process, on a copy of the simulated RAM:
+ *        the allocators of the harness are left untouched.
+ * \return TRUE if the function panicked, FALSE if it returned.
+ */
+bool_t host_expect_panic(void (*fn)(void))
+{
+  int32_t pid = _host_syscall(HOST_SYS_FORK, 0, 0, 0);
+  int32_t status = 0;
+
+  if (pid < 0)
+    panic("fork() failed (%d) in %s()\n", pid, __func__);
+
+  if (pid == 0)
+    {
+      host_quiet_panic = TRUE;
+      _host_ram_copy();
+      fn();
+      host_exit(0);
+    }
+
+  if (_host_syscall(HOST_SYS_WAITPID, (uint32_t)pid, (uint32_t)&status, 0) != pid)
+    panic("waitpid() failed in %s()\n", __func__);
+
+  //Exited normally with the status of panic()
+  return ((status & 0x7F) == 0 && ((status >> 8) & 0xFF) == 2) ? TRUE : FALSE;
+}
+
+
+/*****************************************
+          Stubs of the kernel
+******************************************/
+
+uint32_t kprintf(const char* format, ...)
+{
+  va_list args;
+  uint32_t len;
+
+  va_start(args, format);
+  len = vsnprintf(host_buffer, sizeof(host_buffer), format, args);
+  va_end(args);
+
+  _host_write(host_buffer, len);
+
+  return len;
+}
+
+void panic(const char* format, ...)
+{
+  va_list args;
+  uint32_t len;
+
+  va_start(args, format);
+  len = vsnprintf(host_buffer, sizeof(host_buffer), format, args);
+  va_end(args);
+
+  if (!host_quiet_panic)
+    {
+      _host_write("PANIC: ", 7);
+      _host_write(host_buffer, len);
+    }
+
+  host_exit(2);
+}
+
+void map_page(ppn_t ppn, vpn_t vpn, uint32_t flags)
+{
+  uint32_t index = _host_vpn_index(vpn);
+  uint32_t mmap_flags = HOST_MAP_SHARED | ((host_page_table[index] != 0) ? HOST_MAP_FIXED : HOST_MAP_FIXED_NOREPLACE);
+
+  (void)flags;
+
+  if (ppn >= paddr_to_ppn(HOST_RAM_SIZE))
+    panic("Physical page %u out of the simulated RAM in %s()\n", ppn, __func__);
+
+  if (_host_mmap(vpn_to_vaddr(vpn), VPAGE_SIZE, mmap_flags, ppn_to_paddr(ppn)) != vpn_to_vaddr(vpn))
+    panic("Failed to map the virtual page %u in %s()\n", vpn, __func__);
+
+  if (host_page_table[index] == 0)
+    host_mapped_vpages++;
+
+  host_page_table[index] = ppn + 1;
+}
+
+void map_pages(ppn_t ppn, vpn_t vpn, size_t nbr_pages, uint32_t flags)
+{
+  for (size_t i = 0; i < nbr_pages; i++)
+    map_page(ppn + i, vpn + i, flags);
+}
+
+void unmap_page(vpn_t vpn)
+{
+  uint32_t index = _host_vpn_index(vpn);
+
+  if (host_page_table[index] == 0)
+    return;
+
+  if (_host_syscall(HOST_SYS_MUNMAP, vpn_to_vaddr(vpn), VPAGE_SIZE, 0) != 0)
+    panic("Failed to unmap the virtual page %u in %s()\n", vpn, __func__);
+
+  host_page_table[index] = 0;
+  host_mapped_vpages--;
+}
+
+paddr_t virt_to_phys_addr(vaddr_t vaddr)
+{
+  if (vaddr < KERNEL_SPACE || vaddr >= HOST_KERNEL_SPACE_END)
+    return (paddr_t)NULL;
+
+  uint32_t entry = host_page_table[_host_vpn_index(vaddr_to_vpn(vaddr))];
+
+  if (entry == 0)
+    return (paddr_t)NULL;
+
+  return ppn_to_paddr(entry - 1) + (vaddr & VPAGE_MASK);
+}
@@ -0,0 +1,608 @@
+/**
+ * \file test/host/host_test.c
+ * \brief Correctness tests and micro-benchmarks of the memory allocators,
+ *        run on the host by "make host_test".
+ *
+ * The allocators are initialised like in main(), on the simulated RAM, then
+ * every test checks the content of the memory handed out and the
+ * consistency of the free lists. The benchmarks report the average cost of
+ * an allocation and of a free in nanoseconds, and the fragmentation left by
+ * an alloc/free mix.
+ */
+#include <types.h>
+#include <math.h>
+#include <string.h>
+
+#include <kernel/kernel.h>
+#include <kernel/symbols.h>
+#include <kernel/kprintf.h>
+#include <kernel/panic.h>
+
+#include <kernel/mm/physical_pages.h>
+#include <kernel/mm/virtual_pages.h>
+#include <kernel/mm/slab.h>
+#include <kernel/mm/kmalloc.h>
+
+#include <x86/paging.h>
+#include <x86/x86.h>
+#include <x86/cpucheck.h>
+
+#include "host.h"
+
+#define HOST_TEST_BLOCKS  64  /**< Number of blocks held at once by a test*/
+#define HOST_TEST_OBJS    1024
+#define HOST_BENCH_OPS    256 /**< Number of blocks held at once by a benchmark*/
+#define HOST_BENCH_ROUNDS 64
+
+typedef struct Host_bench{
+  const char *name;
+  void (*alloc)(uint32_t i);
+  void (*free)(uint32_t i);
+  bool_t fragment; /**< Free the odd blocks first, and measure the fragmentation left*/
+} Host_bench;
+
+static ppn_t host_ppns[HOST_TEST_OBJS];
+static uint32_t host_sizes[HOST_TEST_OBJS];
+static void *host_ptrs[HOST_TEST_OBJS];
+static Vregion *host_vregions[HOST_TEST_OBJS];
+
+static Objs_cache *host_bench_cache;
+
+static uint32_t host_failures = 0;
+
+
+/*****************************************
+          Helpers
+******************************************/
+
+#define HOST_CHECK(exp)							\
+  do{									\
+    if (!(exp))								\
+      {									\
+	kprintf("    check " #exp " failed at line %d\n", __LINE__);	\
+	return FALSE;							\
+      }									\
+  }while(0)
+
+/* Linear congruential generator: the runs are reproducible */
+static uint32_t _host_random(void)
+{
+  static uint32_t seed = 1;
+
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+/* Free pages of all the zones, the CPU cache drained */
+static uint32_t _host_free_ppages(void)
+{
+  uint32_t nbr_free_ppages = 0;
+
+  ppages_cpu_cache_drain(current_cpu_id());
+
+  for (ppn_t ppn = 0; ppn < paddr_to_ppn(HOST_RAM_SIZE);)
+    {
+      Physical_memory_zone *zone = ppn_to_zone(ppn);
+
+      if (zone == NULL)
+	{
+	  ppn++;
+	  continue;
+	}
+
+      nbr_free_ppages += zone->free_pages_count;
+      ppn = zone->last_ppn + 1;
+    }
+
+  return nbr_free_ppages;
+}
+
+/* Tag every page of a block in the simulated RAM */
+static void _host_tag_ppages(ppn_t ppn, uint32_t nbr_ppages, uint32_t tag)
+{
+  for (uint32_t i = 0; i < nbr_ppages; i++)
+    *(uint32_t*)host_phys_to_ptr(ppn_to_paddr(ppn + i)) = tag + i;
+}
+
+static bool_t _host_check_ppages_tag(ppn_t ppn, uint32_t nbr_ppages, uint32_t tag)
+{
+  for (uint32_t i = 0; i < nbr_ppages; i++)
+    if (*(uint32_t*)host_phys_to_ptr(ppn_to_paddr(ppn + i)) != tag + i)
+      return FALSE;
+
+  return TRUE;
+}
+
+static void _host_tag_bytes(void *ptr, size_t size, uint8_t tag)
+{
+  memset(ptr, tag, size);
+}
+
+static bool_t _host_check_bytes_tag(const void *ptr, size_t size, uint8_t tag)
+{
+  for (size_t i = 0; i < size; i++)
+    if (((const uint8_t*)ptr)[i] != tag)
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Initialise the allocators like main() does, on the simulated RAM */
+static void _host_boot(void)
+{
+  host_ram_init();
+
+  //A PC-like memory map: the low memory, a hole for the BIOS and the devices, then the RAM above 1MB
+  physical_memory_zone_add(0, 0x9FFFF);
+  physical_memory_zone_add(0x100000, HOST_RAM_SIZE - 1);
+
+  ppn_t kernel_end_ppn = paddr_to_ppn(ROUNDUP(kernel_pa_end, PPAGE_SIZE));
+  Physical_memory_zone *boot_zone = ppn_to_zone(kernel_end_ppn);
+
+  if (boot_zone == NULL)
+    panic("No usable memory after the kernel image!\n");
+
+  _boot_physical_pages_init(kernel_end_ppn, boot_zone->last_ppn);
+  _boot_virtual_pages_init(vaddr_to_vpn(KERNEL_SPACE + ROUNDUP(kernel_pa_end, VPAGE_SIZE)), vaddr_to_vpn(HOST_KERNEL_SPACE_END - 1));
+
+  physical_page_boot_init();
+  objs_cache_boot_init();
+  kmalloc_boot_init();
+}
+
+
+/*****************************************
+          Correctness tests
+******************************************/
+
+static bool_t _host_test_ppage_blocks(void)
+{
+  uint32_t nbr_free_ppages = _host_free_ppages();
+
+  for (uint32_t order = 0; order < MIN((uint32_t)7, (uint32_t)MAX_PPAGE_BLOCK_ORDER); order++)
+    {
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+	{
+	  host_ppns[i] = ppage_block_alloc(order);
+	  HOST_CHECK(host_ppns[i] != NULL_PPN);
+	  HOST_CHECK(host_ppns[i] % (1UL << order) == 0);
+	  _host_tag_ppages(host_ppns[i], 1UL << order, i << 16);
+	}
+
+      //No block overlaps another one
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+	HOST_CHECK(_host_check_ppages_tag(host_ppns[i], 1UL << order, i << 16));
+
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+	ppage_block_free(host_ppns[i], order);
+
+      HOST_CHECK(DEBUG_check_physical_pages());
+    }
+
+  HOST_CHECK(_host_free_ppages() == nbr_free_ppages);
+
+  return TRUE;
+}
+
+static bool_t _host_test_ppages_exact(void)
+{
+  uint32_t nbr_free_ppages = _host_free_ppages();
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    {
+      host_sizes[i] = 1 + (_host_random() % 17);
+      host_ppns[i] = ppages_alloc_exact(host_sizes[i]);
+      HOST_CHECK(host_ppns[i] != NULL_PPN);
+      _host_tag_ppages(host_ppns[i], host_sizes[i], i << 16);
+    }
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    HOST_CHECK(_host_check_ppages_tag(host_ppns[i], host_sizes[i], i << 16));
+
+  //The exact blocks freed in any order must merge back
+  for (uint32_t i = 1; i < HOST_TEST_BLOCKS; i += 2)
+    ppages_free_exact(host_ppns[i], host_sizes[i]);
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i += 2)
+    ppages_free_exact(host_ppns[i], host_sizes[i]);
+
+  HOST_CHECK(DEBUG_check_physical_pages());
+  HOST_CHECK(_host_free_ppages() == nbr_free_ppages);
+
+  return TRUE;
+}
+
+static bool_t _host_test_ppages_bulk(void)
+{
+  uint32_t nbr_free_ppages = _host_free_ppages();
+  uint32_t nbr_ppages = ppages_alloc_bulk(host_ppns, HOST_TEST_OBJS);
+
+  HOST_CHECK(nbr_ppages == HOST_TEST_OBJS);
+
+  for (uint32_t i = 0; i < nbr_ppages; i++)
+    _host_tag_ppages(host_ppns[i], 1, i << 16);
+
+  for (uint32_t i = 0; i < nbr_ppages; i++)
+    HOST_CHECK(_host_check_ppages_tag(host_ppns[i], 1, i << 16));
+
+  ppages_free_bulk(host_ppns, nbr_ppages);
+
+  HOST_CHECK(DEBUG_check_physical_pages());
+  HOST_CHECK(_host_free_ppages() == nbr_free_ppages);
+
+  return TRUE;
+}
+
+static bool_t _host_test_vregions(void)
+{
+  uint32_t nbr_free_ppages = _host_free_ppages();
+  uint32_t nbr_mapped_vpages = host_mapped_vpages_count();
+  vpn_t lowest_vpn = NULL_VPN;
+  uint32_t nbr_vpages = 0;
+
+  //A first pass leaves cache_Vregion with enough descriptors for the second one
+  for (uint32_t pass = 0; pass < 2; pass++)
+    {
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+	{
+	  host_sizes[i] = 2 + (_host_random() % 8);
+	  host_vregions[i] = vregion_alloc(host_sizes[i]);
+	  HOST_CHECK(host_vregions[i] != NULL);
+	  HOST_CHECK(vregion_size(host_vregions[i]) == host_sizes[i] * VPAGE_SIZE);
+
+	  //Each region is found from any of its addresses
+	  HOST_CHECK(vaddr_to_vregion(vpn_to_vaddr(vregion_first_vpn(host_vregions[i]))) == host_vregions[i]);
+	  HOST_CHECK(vaddr_to_vregion(vpn_to_vaddr(vregion_last_vpn(host_vregions[i])) + VPAGE_SIZE - 1) == host_vregions[i]);
+
+	  //Half of the regions are backed, vregion_free() must give their pages back
+	  if (i % 2 == 0)
+	    for (vpn_t vpn = vregion_first_vpn(host_vregions[i]); vpn <= vregion_last_vpn(host_vregions[i]); vpn++)
+	      {
+		vaddr_t vaddr = vpn_to_vaddr(vpn);
+
+		map_page(ppage_alloc(), vpn, PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR);
+		_host_tag_bytes((void*)vaddr, VPAGE_SIZE, (uint8_t)i);
+	      }
+
+	  if (pass == 1)
+	    {
+	      lowest_vpn = MIN(lowest_vpn, vregion_first_vpn(host_vregions[i]));
+	      nbr_vpages += host_sizes[i];
+	    }
+	}
+
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i += 2)
+	for (vaddr_t vaddr = vpn_to_vaddr(vregion_first_vpn(host_vregions[i]));
+	     vaddr < vpn_to_vaddr(vregion_last_vpn(host_vregions[i]) + 1); vaddr += VPAGE_SIZE)
+	  HOST_CHECK(_host_check_bytes_tag((void*)vaddr, VPAGE_SIZE, (uint8_t)i));
+
+      for (uint32_t i = 1; i < HOST_TEST_BLOCKS; i += 2)
+	vregion_free(host_vregions[i]);
+      for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i += 2)
+	vregion_free(host_vregions[i]);
+    }
+
+  HOST_CHECK(host_mapped_vpages_count() == nbr_mapped_vpages);
+  HOST_CHECK(_host_free_ppages() == nbr_free_ppages);
+
+  //The freed regions are coalesced: all of them fit again at the lowest address
+  Vregion *vregion = vregion_alloc(nbr_vpages);
+
+  HOST_CHECK(vregion != NULL);
+  HOST_CHECK(vregion_first_vpn(vregion) == lowest_vpn);
+  vregion_free(vregion);
+
+  //A frame mapped in two regions is freed with the second one
+  Vregion *first = vregion_alloc(2);
+  Vregion *second = vregion_alloc(2);
+  ppn_t shared_ppn = ppage_alloc();
+
+  HOST_CHECK(first != NULL && second != NULL);
+  map_page(shared_ppn, vregion_first_vpn(first), PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR);
+  map_page(shared_ppn, vregion_first_vpn(second), PAGE_PRESENT | PAGE_READ_WRITE | PAGE_SUPERVISOR);
+  ppage_ref(ppn_to_ppage(shared_ppn));
+
+  vregion_free(first);
+  HOST_CHECK(!ppage_is_free(ppn_to_ppage(shared_ppn)) && ppage_count(ppn_to_ppage(shared_ppn)) == 1);
+  vregion_free(second);
+  HOST_CHECK(_host_free_ppages() == nbr_free_ppages);
+
+  //The single pages come from the CPU cache
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    {
+      host_vregions[i] = vregion_alloc(1);
+      HOST_CHECK(host_vregions[i] != NULL);
+      HOST_CHECK(vaddr_to_vregion(vpn_to_vaddr(vregion_first_vpn(host_vregions[i]))) == host_vregions[i]);
+    }
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    vregion_free(host_vregions[i]);
+
+  //A lazy single page kept in the CPU cache isn't found by the page fault handler
+  vregion = vregion_alloc_lazy(1);
+  HOST_CHECK(vregion != NULL);
+
+  vaddr_t lazy_vaddr = vpn_to_vaddr(vregion_first_vpn(vregion));
+
+  vregion_free(vregion);
+  HOST_CHECK(vaddr_to_vregion(lazy_vaddr) == NULL);
+  HOST_CHECK(vregion_page_fault(lazy_vaddr) == FALSE);
+  HOST_CHECK(vregion_alloc(1) == vregion && vregion->flags == 0);
+  vregion_free(vregion);
+
+  return TRUE;
+}
+
+static bool_t _host_test_objs_cache(const char *name, size_t obj_size, uint32_t flags, size_t align)
+{
+  Objs_cache *cache = objs_cache_create(name, obj_size, 1, flags);
+
+  HOST_CHECK(cache != NULL);
+  HOST_CHECK(cache->align % align == 0);
+  HOST_CHECK((flags & OBJS_CACHE_NO_MAGAZINES) ? cache->cpus[0] == NULL : (vaddr_t)cache->cpus[0] % cpu_cache_line_size() == 0);
+
+  for (uint32_t round = 0; round < 2; round++)
+    {
+      for (uint32_t i = 0; i < HOST_TEST_OBJS; i++)
+	{
+	  host_ptrs[i] = objs_cache_alloc(cache);
+	  HOST_CHECK(host_ptrs[i] != NULL);
+	  HOST_CHECK((vaddr_t)host_ptrs[i] % align == 0);
+	  _host_tag_bytes(host_ptrs[i], obj_size, (uint8_t)i);
+	}
+
+      for (uint32_t i = 0; i < HOST_TEST_OBJS; i++)
+	HOST_CHECK(_host_check_bytes_tag(host_ptrs[i], obj_size, (uint8_t)i));
+
+      HOST_CHECK(cache->used_objs_count + cache->free_objs_count == cache->objs_per_slab * cache->slabs_count);
+
+      //Freed in another order than allocated, through the magazines
+      for (uint32_t i = 1; i < HOST_TEST_OBJS; i += 2)
+	objs_cache_free(cache, host_ptrs[i]);
+      for (uint32_t i = 0; i < HOST_TEST_OBJS; i += 2)
+	objs_cache_free(cache, host_ptrs[i]);
+    }
+
+  //A single CPU never misses what another one holds
+  HOST_CHECK(cache->magazine_size == OBJS_MAGAZINE_MIN_ROUNDS);
+
+  objs_cache_drain(cache);
+  HOST_CHECK(cache->used_objs_count == 0);
+
+  return TRUE;
+}
+
+/* Free an object of a cache into another cache of the same object size */
+static void _host_free_to_wrong_cache(void)
+{
+  Objs_cache *owner = objs_cache_create("host_test_owner", 32, 1, OBJS_CACHE_NO_MAGAZINES);
+  Objs_cache *other = objs_cache_create("host_test_other", 32, 1, OBJS_CACHE_NO_MAGAZINES);
+
+  objs_cache_alloc(other);
+  objs_cache_free(other, objs_cache_alloc(owner));
+}
+
+static bool_t _host_test_objs_caches(void)
+{
+  HOST_CHECK(host_expect_panic(_host_free_to_wrong_cache));
+
+  return (_host_test_objs_cache("host_test_40", 40, 0, sizeof(void*)) &&
+	  _host_test_objs_cache("host_test_hw", 24, OBJS_CACHE_HWCACHE_ALIGN, cpu_cache_line_size()) &&
+	  _host_test_objs_cache("host_test_256", 100, OBJS_CACHE_ALIGN(256), 256) &&
+	  _host_test_objs_cache("host_test_raw", 16, OBJS_CACHE_NO_MAGAZINES, sizeof(void*)));
+}
+
+static bool_t _host_test_kmalloc(void)
+{
+  uint32_t nbr_mapped_vpages = host_mapped_vpages_count();
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    {
+      //Mostly size classes, sometimes large allocations
+      host_sizes[i] = 1 + ((i % 8 == 7) ? _host_random() % (4 * KMALLOC_MAX_CLASS_SIZE) : _host_random() % KMALLOC_MAX_CLASS_SIZE);
+      host_ptrs[i] = kmalloc(host_sizes[i]);
+      HOST_CHECK(host_ptrs[i] != NULL);
+      HOST_CHECK((vaddr_t)host_ptrs[i] % sizeof(void*) == 0);
+      _host_tag_bytes(host_ptrs[i], host_sizes[i], (uint8_t)i);
+
+      //A small allocation is owned by a size class big enough
+      Slab *slab = ppage_slab(paddr_to_ppage(virt_to_phys_addr((vaddr_t)host_ptrs[i])));
+
+      HOST_CHECK((slab != NULL) == (host_sizes[i] <= KMALLOC_MAX_CLASS_SIZE));
+      HOST_CHECK(slab == NULL || slab->cache->obj_size >= host_sizes[i]);
+    }
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    HOST_CHECK(_host_check_bytes_tag(host_ptrs[i], host_sizes[i], (uint8_t)i));
+
+  for (uint32_t i = 0; i < HOST_TEST_BLOCKS; i++)
+    kfree(host_ptrs[i]);
+
+  //The large allocations are unmapped, the slabs may stay
+  HOST_CHECK(host_mapped_vpages_count() <= nbr_mapped_vpages + HOST_TEST_BLOCKS);
+  HOST_CHECK(DEBUG_check_physical_pages());
+
+  return TRUE;
+}
+
+
+/*****************************************
+          Benchmarks
+******************************************/
+
+static void _host_bench_ppage_alloc(uint32_t i)       { host_ppns[i] = ppage_alloc(); }
+static void _host_bench_ppage_free(uint32_t i)        { ppage_free(host_ppns[i]); }
+static void _host_bench_block_alloc(uint32_t i)       { host_ppns[i] = ppage_block_alloc(3); }
+static void _host_bench_block_free(uint32_t i)        { ppage_block_free(host_ppns[i], 3); }
+static void _host_bench_exact_alloc(uint32_t i)       { host_ppns[i] = ppages_alloc_exact(host_sizes[i]); }
+static void _host_bench_exact_free(uint32_t i)        { ppages_free_exact(host_ppns[i], host_sizes[i]); }
+static void _host_bench_vregion_alloc(uint32_t i)     { host_vregions[i] = vregion_alloc(host_sizes[i]); }
+static void _host_bench_vregion_free(uint32_t i)      { vregion_free(host_vregions[i]); }
+static void _host_bench_objs_cache_alloc(uint32_t i)  { host_ptrs[i] = objs_cache_alloc(host_bench_cache); }
+static void _host_bench_objs_cache_free(uint32_t i)   { objs_cache_free(host_bench_cache, host_ptrs[i]); }
+static void _host_bench_kmalloc(uint32_t i)           { host_ptrs[i] = kmalloc(host_sizes[i]); }
+static void _host_bench_kfree(uint32_t i)             { kfree(host_ptrs[i]); }
+
+/* Run a benchmark HOST_BENCH_ROUNDS times, the sizes are set by the caller */
+static void _host_bench_run(const Host_bench *bench)
+{
+  uint32_t alloc_ns = 0;
+  uint32_t free_ns = 0;
+  uint32_t unusable_order3 = 0;
+  uint32_t unusable_pageblock = 0;
+
+  for (uint32_t round = 0; round < HOST_BENCH_ROUNDS; round++)
+    {
+      uint32_t start_ns = host_clock_ns();
+
+      for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+	bench->alloc(i);
+
+      alloc_ns += host_clock_ns() - start_ns;
+
+      if (bench->fragment == FALSE)
+	{
+	  start_ns = host_clock_ns();
+
+	  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+	    bench->free(i);
+
+	  free_ns += host_clock_ns() - start_ns;
+	  continue;
+	}
+
+      //One block out of two is freed, the fragmentation is measured out of the timed frees
+      start_ns = host_clock_ns();
+
+      for (uint32_t i = 1; i < HOST_BENCH_OPS; i += 2)
+	bench->free(i);
+
+      free_ns += host_clock_ns() - start_ns;
+
+      unusable_order3 += DEBUG_unusable_free_space(3);
+      unusable_pageblock += DEBUG_unusable_free_space(PPAGEBLOCK_ORDER);
+
+      start_ns = host_clock_ns();
+
+      for (uint32_t i = 0; i < HOST_BENCH_OPS; i += 2)
+	bench->free(i);
+
+      free_ns += host_clock_ns() - start_ns;
+    }
+
+  kprintf("  %s : %u ns/alloc, %u ns/free\n", bench->name,
+	  alloc_ns / (HOST_BENCH_ROUNDS * HOST_BENCH_OPS),
+	  free_ns / (HOST_BENCH_ROUNDS * HOST_BENCH_OPS));
+
+  if (bench->fragment == TRUE)
+    kprintf("    half freed : unusable free space order 3 %u%%, order %u %u%%\n",
+	    unusable_order3 / HOST_BENCH_ROUNDS, PPAGEBLOCK_ORDER, unusable_pageblock / HOST_BENCH_ROUNDS);
+}
+
+static void _host_benchmarks(void)
+{
+  static const Host_bench ppage      = {"single page", _host_bench_ppage_alloc, _host_bench_ppage_free, FALSE};
+  static const Host_bench block      = {"order 3 block", _host_bench_block_alloc, _host_bench_block_free, FALSE};
+  static const Host_bench exact      = {"exact 5 pages", _host_bench_exact_alloc, _host_bench_exact_free, FALSE};
+  static const Host_bench mixed      = {"mixed exact 1-16 pages", _host_bench_exact_alloc, _host_bench_exact_free, TRUE};
+  static const Host_bench vregion1   = {"vregion 1 page", _host_bench_vregion_alloc, _host_bench_vregion_free, FALSE};
+  static const Host_bench vregion16  = {"vregion 16 pages", _host_bench_vregion_alloc, _host_bench_vregion_free, FALSE};
+  static const Host_bench objs_cache = {"objs_cache 64 B", _host_bench_objs_cache_alloc, _host_bench_objs_cache_free, FALSE};
+  static const Host_bench kmallocs   = {"kmalloc 8-2048 B", _host_bench_kmalloc, _host_bench_kfree, FALSE};
+
+  kprintf("Benchmarks (%u blocks held, %u rounds)\n", HOST_BENCH_OPS, HOST_BENCH_ROUNDS);
+
+  _host_bench_run(&ppage);
+  _host_bench_run(&block);
+
+  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+    host_sizes[i] = 5;
+  _host_bench_run(&exact);
+
+  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+    host_sizes[i] = 1 + (_host_random() % 16);
+  _host_bench_run(&mixed);
+
+  //Bulk single pages: a call per round
+  uint32_t alloc_ns = 0;
+  uint32_t free_ns = 0;
+
+  for (uint32_t round = 0; round < HOST_BENCH_ROUNDS; round++)
+    {
+      uint32_t start_ns = host_clock_ns();
+      uint32_t nbr_ppages = ppages_alloc_bulk(host_ppns, HOST_BENCH_OPS);
+
+      alloc_ns += host_clock_ns() - start_ns;
+
+      start_ns = host_clock_ns();
+      ppages_free_bulk(host_ppns, nbr_ppages);
+      free_ns += host_clock_ns() - start_ns;
+    }
+
+  kprintf("  bulk single pages : %u ns/alloc, %u ns/free\n",
+	  alloc_ns / (HOST_BENCH_ROUNDS * HOST_BENCH_OPS), free_ns / (HOST_BENCH_ROUNDS * HOST_BENCH_OPS));
+
+  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+    host_sizes[i] = 1;
+  _host_bench_run(&vregion1);
+
+  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+    host_sizes[i] = 16;
+  _host_bench_run(&vregion16);
+
+  host_bench_cache = objs_cache_create("host_bench_64", 64, 1, 0);
+  _host_bench_run(&objs_cache);
+
+  for (uint32_t i = 0; i < HOST_BENCH_OPS; i++)
+    host_sizes[i] = 8 + (_host_random() % (KMALLOC_MAX_CLASS_SIZE - 7));
+  _host_bench_run(&kmallocs);
+
+  kprintf("  unusable free space after the benchmarks : order 3 %u%%, order %u %u%%\n",
+	  DEBUG_unusable_free_space(3), PPAGEBLOCK_ORDER, DEBUG_unusable_free_space(PPAGEBLOCK_ORDER));
+}
+
+
+/*****************************************
+          Entry point
+******************************************/
+
+int32_t host_main(void)
+{
+  static const struct{
+    const char *name;
+    bool_t (*run)(void);
+  } tests[] =
+      {
+	{"physical blocks", _host_test_ppage_blocks},
+	{"exact physical allocations", _host_test_ppages_exact},
+	{"bulk physical pages", _host_test_ppages_bulk},
+	{"virtual regions", _host_test_vregions},
+	{"objects caches", _host_test_objs_caches},
+	{"kmalloc", _host_test_kmalloc}
+      };
+
+  _host_boot();
+
+  kprintf("Tests\n");
+
+  for (uint32_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+      bool_t ok = tests[i].run();
+
+      kprintf("  %s : %s\n", tests[i].name, (ok == TRUE) ? "ok" : "FAILED");
+
+      if (ok == FALSE)
+	host_failures++;
+    }
+
+  if (DEBUG_check_physical_pages() == FALSE)
+    host_failures++;
+
+  _host_benchmarks();
+
+  if (DEBUG_check_physical_pages() == FALSE)
+    host_failures++;
+
+  kprintf("%u test(s) failed\n", host_failures);
+
+  return (host_failures == 0) ? 0 : 1;
+}